@@ -0,0 +1,585 @@
+// Micro-benchmarks for the per-byte helpers of the eBUS core.
+//
+//   ebus_bench [-f filter] [-w baseline.txt] [-b baseline.txt] [-t percent]
+//
+// -w records the results as a baseline, -b compares against one and exits
+// non zero when any benchmark is slower by more than -t percent (default 10).
+// Cycles are TSC cycles on x86, elsewhere they are derived from the time.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "ebus.h"
+#include "ebus_dev.h"
+#include "ebus_stream.h"
+
+extern "C" uint8_t _CRC_LOOKUP_TABLE(uint8_t crc);
+
+template<typename T>
+static inline void DoNotOptimize(T const &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+static inline uint64_t Cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static inline uint64_t Nanos()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// typical frames: plain, and with SYN/ESC bytes that need escaping
+static const uint8_t frame_plain[] = {0x10, 0x08, 0xb5, 0x11, 0x01, 0x01, 0x89};
+static const uint8_t frame_id[] = {0x10, 0xfe, 0x07, 0x04, 0x0a, 0xb5, 0x56, 0x52, 0x5f, 0x39, 0x31, 0x02, 0x01, 0x19, 0x03, 0xa9};
+static const uint8_t frame_escaped[] = {0x10, 0x26, 0xb5, 0x09, 0x06, 0xa9, 0xaa, 0x00, 0xaa, 0xa9, 0x15, 0x00};
+
+static EbusMessage MakeStatusMessage()
+{
+    EbusMessage msg(0x10, 0x08, 0xb511);
+    const uint8_t data[] = {0x8f, 0x6f, 0x80, 0x0d, 0x7b, 0x7f, 0x01, 0x00, 0xff};
+    for (auto c : data)
+        msg.AddPayload(c);
+    msg.SetCRC();
+    return msg;
+}
+
+static EbusResponse MakeStatusResponse()
+{
+    EbusResponse resp;
+    const uint8_t data[] = {0x40, 0x3e, 0x00, 0x0a, 0x3c, 0x3e, 0x00, 0x00, 0xff};
+    for (auto c : data)
+        resp.AddPayload(c);
+    resp.SetCRC();
+    return resp;
+}
+
+static void AppendWire(std::vector<uint8_t> &wire, const uint8_t *data, int len)
+{
+    for (int n = 0; n < len; n++) {
+        auto c = data[n];
+        if (c == ESC || c == SYN) {
+            wire.push_back(ESC);
+            c = c == ESC ? 0 : 1;
+        }
+        wire.push_back(c);
+    }
+}
+
+// foreign traffic as recorded on the wire: a status poll with its
+// response, a broadcast identification and the SYNs between them
+static std::vector<uint8_t> RecordedStream()
+{
+    std::vector<uint8_t> wire;
+    auto msg = MakeStatusMessage();
+    auto resp = MakeStatusResponse();
+    for (int n = 0; n < 4; n++) {
+        AppendWire(wire, msg.GetBuffer(), msg.GetBufferLength());
+        wire.push_back(ACK);
+        AppendWire(wire, resp.GetBuffer(), resp.GetBufferLength());
+        wire.push_back(ACK);
+        wire.push_back(SYN);
+        AppendWire(wire, frame_id, sizeof(frame_id));
+        wire.push_back(SYN);
+        wire.push_back(SYN);
+    }
+    return wire;
+}
+
+// the bus task parser with no uart behind it, nothing of ours is on the wire
+class BenchBus : public EbusBusStream
+{
+    void SendData(const uint8_t *data, int len) {}
+    int ReadBytes(uint8_t *buf, int len) { return -1; }
+};
+
+static BenchBus *GetBenchBus()
+{
+    static BenchBus *bus;
+    if (!bus) {
+        bus = new BenchBus();
+        // the SYN timer, the task is never run
+        bus->start();
+    }
+    return bus;
+}
+
+struct Bench
+{
+    const char *name;
+    const char *unit;
+    // runs the body n times and returns the number of units done
+    uint64_t (*run)(uint64_t n);
+};
+
+static uint64_t BenchCrcLookup(uint64_t n)
+{
+    uint8_t crc = 0;
+    for (uint64_t i = 0; i < n; i++)
+        crc = _CRC_LOOKUP_TABLE(crc ^ (uint8_t)i);
+    DoNotOptimize(crc);
+    return n;
+}
+
+static uint64_t BenchCrcPlain(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++) {
+        DoNotOptimize(frame_plain);
+        DoNotOptimize(crc8v(frame_plain, sizeof(frame_plain) - 1));
+    }
+    return n;
+}
+
+static uint64_t BenchCrcId(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++) {
+        DoNotOptimize(frame_id);
+        DoNotOptimize(crc8v(frame_id, sizeof(frame_id) - 1));
+    }
+    return n;
+}
+
+static uint64_t BenchCrcEscaped(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++) {
+        DoNotOptimize(frame_escaped);
+        DoNotOptimize(crc8v(frame_escaped, sizeof(frame_escaped) - 1));
+    }
+    return n;
+}
+
+// the loop before the escape table, two lookups for SYN and ESC
+static uint8_t Crc8vBytewise(const uint8_t *buf, int len)
+{
+    uint8_t crc = 0;
+    while (len--) {
+        uint8_t c = *buf++;
+        if (c == ESC || c == SYN) {
+            c = c == ESC ? 0 : 1;
+            crc = _CRC_LOOKUP_TABLE(crc) ^ ESC;
+        }
+        crc = _CRC_LOOKUP_TABLE(crc) ^ c;
+    }
+    return crc;
+}
+
+static uint64_t BenchCrcBytewise(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++) {
+        DoNotOptimize(frame_escaped);
+        DoNotOptimize(Crc8vBytewise(frame_escaped, sizeof(frame_escaped) - 1));
+    }
+    return n;
+}
+
+// a capture to validate offline: the three frames over and over
+#define BENCH_FRAMES 256
+#define BENCH_FRAME_STRIDE 32
+
+struct BenchCapture
+{
+    uint8_t frames[BENCH_FRAMES][BENCH_FRAME_STRIDE];
+    uint8_t lens[BENCH_FRAMES];
+    uint8_t crcs[BENCH_FRAMES];
+
+    BenchCapture()
+    {
+        const uint8_t *sources[] = {frame_plain, frame_id, frame_escaped};
+        const uint8_t sizes[] = {sizeof(frame_plain), sizeof(frame_id), sizeof(frame_escaped)};
+        for (int n = 0; n < BENCH_FRAMES; n++) {
+            lens[n] = sizes[n % 3] - 1;
+            memcpy(frames[n], sources[n % 3], lens[n]);
+        }
+    }
+};
+
+static uint64_t BenchCrcFrames(uint64_t n)
+{
+    static BenchCapture capture;
+    for (uint64_t i = 0; i < n; i++) {
+        DoNotOptimize(capture.frames);
+        for (int f = 0; f < BENCH_FRAMES; f++)
+            capture.crcs[f] = crc8v(capture.frames[f], capture.lens[f]);
+        DoNotOptimize(capture.crcs);
+    }
+    return n * BENCH_FRAMES;
+}
+
+static uint64_t BenchCrcBatch(uint64_t n)
+{
+    static BenchCapture capture;
+    for (uint64_t i = 0; i < n; i++) {
+        DoNotOptimize(capture.frames);
+        crc8v_batch(&capture.frames[0][0], BENCH_FRAME_STRIDE, capture.lens, capture.crcs, BENCH_FRAMES);
+        DoNotOptimize(capture.crcs);
+    }
+    return n * BENCH_FRAMES;
+}
+
+static uint64_t BenchReadData1c(uint64_t n)
+{
+    auto msg = MakeStatusMessage();
+    for (uint64_t i = 0; i < n; i++) {
+        DoNotOptimize(msg);
+        DoNotOptimize(msg.ReadPayloadData1c(i & 7));
+    }
+    return n;
+}
+
+static uint64_t BenchReadData2b(uint64_t n)
+{
+    auto msg = MakeStatusMessage();
+    for (uint64_t i = 0; i < n; i++) {
+        DoNotOptimize(msg);
+        DoNotOptimize(msg.ReadPayloadData2b(i & 7));
+    }
+    return n;
+}
+
+static uint64_t BenchReadData2c(uint64_t n)
+{
+    auto msg = MakeStatusMessage();
+    for (uint64_t i = 0; i < n; i++) {
+        DoNotOptimize(msg);
+        DoNotOptimize(msg.ReadPayloadData2c(i & 7));
+    }
+    return n;
+}
+
+static uint64_t BenchReadEXP(uint64_t n)
+{
+    EbusMessage msg(0x10, 0x15, 0xb524);
+    msg.AddPayloadEXP(EbusFixed::FromFloat(19.5f));
+    msg.AddPayloadEXP(EbusFixed::FromFloat(-3.25f));
+    for (uint64_t i = 0; i < n; i++) {
+        DoNotOptimize(msg);
+        DoNotOptimize(msg.ReadPayloadEXP((i & 1) * 4));
+    }
+    return n;
+}
+
+static uint64_t BenchReadBCD(uint64_t n)
+{
+    auto msg = MakeStatusMessage();
+    for (uint64_t i = 0; i < n; i++) {
+        DoNotOptimize(msg);
+        DoNotOptimize(msg.ReadPayloadBCD(i & 7));
+    }
+    return n;
+}
+
+// the encoders append, so each round fills a fresh response with 8 values
+static uint64_t BenchAddPayload(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++) {
+        EbusResponse resp;
+        for (int j = 0; j < 8; j++)
+            resp.AddPayload((uint8_t)(i + j));
+        DoNotOptimize(resp);
+    }
+    return n * 8;
+}
+
+static uint64_t BenchAddBCD(uint64_t n)
+{
+    for (uint64_t i = 0; i < n; i++) {
+        EbusResponse resp;
+        for (int j = 0; j < 8; j++)
+            resp.AddPayloadBCD((uint8_t)((i + j) % 100));
+        DoNotOptimize(resp);
+    }
+    return n * 8;
+}
+
+static uint64_t BenchAddData1c(uint64_t n)
+{
+    auto f = EbusFixed::FromFloat(21.5f);
+    for (uint64_t i = 0; i < n; i++) {
+        EbusResponse resp;
+        DoNotOptimize(f);
+        for (int j = 0; j < 8; j++)
+            resp.AddPayloadData1c(f + EbusFixed::FromInt(j));
+        DoNotOptimize(resp);
+    }
+    return n * 8;
+}
+
+static uint64_t BenchAddData2b(uint64_t n)
+{
+    auto f = EbusFixed::FromFloat(13.25f);
+    for (uint64_t i = 0; i < n; i++) {
+        EbusResponse resp;
+        DoNotOptimize(f);
+        for (int j = 0; j < 4; j++)
+            resp.AddPayloadData2b(f + EbusFixed::FromInt(j));
+        DoNotOptimize(resp);
+    }
+    return n * 4;
+}
+
+static uint64_t BenchAddData2c(uint64_t n)
+{
+    auto f = EbusFixed::FromFloat(71.5f);
+    for (uint64_t i = 0; i < n; i++) {
+        EbusResponse resp;
+        DoNotOptimize(f);
+        for (int j = 0; j < 4; j++)
+            resp.AddPayloadData2c(f + EbusFixed::FromInt(j));
+        DoNotOptimize(resp);
+    }
+    return n * 4;
+}
+
+static uint64_t BenchAddEXP(uint64_t n)
+{
+    auto f = EbusFixed::FromFloat(19.5f);
+    for (uint64_t i = 0; i < n; i++) {
+        EbusResponse resp;
+        DoNotOptimize(f);
+        for (int j = 0; j < 4; j++)
+            resp.AddPayloadEXP(f + EbusFixed::FromInt(j));
+        DoNotOptimize(resp);
+    }
+    return n * 4;
+}
+
+static uint64_t BenchSetCRC(uint64_t n)
+{
+    auto msg = MakeStatusMessage();
+    for (uint64_t i = 0; i < n; i++) {
+        DoNotOptimize(msg);
+        msg.SetCRC();
+    }
+    DoNotOptimize(msg);
+    return n;
+}
+
+static uint64_t BenchIsValidCRC(uint64_t n)
+{
+    auto msg = MakeStatusMessage();
+    for (uint64_t i = 0; i < n; i++) {
+        DoNotOptimize(msg);
+        DoNotOptimize(msg.IsValidCRC());
+    }
+    return n;
+}
+
+// a whole request fed byte by byte and checked, as the bus task does
+static uint64_t BenchMessageWriter(uint64_t n)
+{
+    auto msg = MakeStatusMessage();
+    auto buf = msg.GetBuffer();
+    int len = msg.GetBufferLength();
+    EbusMessageWriter writer;
+    for (uint64_t i = 0; i < n; i++) {
+        writer.Reset();
+        DoNotOptimize(buf);
+        for (int j = 0; j < len; j++)
+            writer.Write(buf[j]);
+        DoNotOptimize(writer.IsValidCRC());
+    }
+    return n;
+}
+
+static uint64_t BenchResponseWriter(uint64_t n)
+{
+    auto resp = MakeStatusResponse();
+    auto buf = resp.GetBuffer();
+    int len = resp.GetBufferLength();
+    EbusResponseWriter writer;
+    for (uint64_t i = 0; i < n; i++) {
+        writer.Reset();
+        DoNotOptimize(buf);
+        for (int j = 0; j < len; j++)
+            writer.Write(buf[j]);
+        DoNotOptimize(writer.IsValidCRC());
+    }
+    return n;
+}
+
+// the recorded stream one byte per call, as the old ReadByte loop did
+static uint64_t BenchParseBytes(uint64_t n)
+{
+    static auto wire = RecordedStream();
+    auto bus = GetBenchBus();
+    for (uint64_t i = 0; i < n; i++) {
+        for (auto c : wire)
+            bus->ProcessBytes(&c, 1);
+    }
+    return n * wire.size();
+}
+
+// the recorded stream in bursts as the uart driver buffers them
+static uint64_t BenchParseBurst(uint64_t n)
+{
+    static auto wire = RecordedStream();
+    auto bus = GetBenchBus();
+    for (uint64_t i = 0; i < n; i++) {
+        for (size_t pos = 0; pos < wire.size(); pos += EBUS_RX_BURST) {
+            size_t len = wire.size() - pos;
+            bus->ProcessBytes(wire.data() + pos, len < EBUS_RX_BURST ? len : EBUS_RX_BURST);
+        }
+    }
+    return n * wire.size();
+}
+
+static const Bench benches[] = {
+    {"crc_lookup", "op", BenchCrcLookup},
+    {"crc8v_plain", "frame", BenchCrcPlain},
+    {"crc8v_id", "frame", BenchCrcId},
+    {"crc8v_escaped", "frame", BenchCrcEscaped},
+    {"crc8v_bytewise", "frame", BenchCrcBytewise},
+    {"crc8v_frames", "frame", BenchCrcFrames},
+    {"crc8v_batch", "frame", BenchCrcBatch},
+    {"read_data1c", "op", BenchReadData1c},
+    {"read_data2b", "op", BenchReadData2b},
+    {"read_data2c", "op", BenchReadData2c},
+    {"read_exp", "op", BenchReadEXP},
+    {"read_bcd", "op", BenchReadBCD},
+    {"add_payload", "op", BenchAddPayload},
+    {"add_bcd", "op", BenchAddBCD},
+    {"add_data1c", "op", BenchAddData1c},
+    {"add_data2b", "op", BenchAddData2b},
+    {"add_data2c", "op", BenchAddData2c},
+    {"add_exp", "op", BenchAddEXP},
+    {"set_crc", "frame", BenchSetCRC},
+    {"is_valid_crc", "frame", BenchIsValidCRC},
+    {"message_writer", "frame", BenchMessageWriter},
+    {"response_writer", "frame", BenchResponseWriter},
+    {"parse_bytes", "byte", BenchParseBytes},
+    {"parse_burst", "byte", BenchParseBurst},
+};
+
+struct Result
+{
+    double ns;
+    double cycles;
+};
+
+static Result Measure(const Bench &bench)
+{
+    // grow the batch until it takes long enough to time, then take the best of 5
+    uint64_t n = 1000;
+    while (true) {
+        auto t0 = Nanos();
+        bench.run(n);
+        if (Nanos() - t0 > 20000000)
+            break;
+        n *= 2;
+    }
+    Result best = {1e30, 1e30};
+    for (int rep = 0; rep < 5; rep++) {
+        auto t0 = Nanos();
+        auto c0 = Cycles();
+        auto units = bench.run(n);
+        auto c1 = Cycles();
+        auto t1 = Nanos();
+        double ns = (double)(t1 - t0) / units;
+        if (ns < best.ns)
+            best = {ns, (double)(c1 - c0) / units};
+    }
+    return best;
+}
+
+static std::map<std::string, double> LoadBaseline(const char *path)
+{
+    std::map<std::string, double> baseline;
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return baseline;
+    }
+    char line[128], name[64];
+    double ns, cycles;
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#')
+            continue;
+        if (sscanf(line, "%63s %lf %lf", name, &ns, &cycles) >= 2)
+            baseline[name] = ns;
+    }
+    fclose(f);
+    return baseline;
+}
+
+int main(int argc, char **argv)
+{
+    const char *filter = nullptr;
+    const char *record = nullptr;
+    const char *compare = nullptr;
+    double threshold = 10;
+
+    for (int n = 1; n < argc; n++) {
+        if (!strcmp(argv[n], "-f") && n + 1 < argc)
+            filter = argv[++n];
+        else if (!strcmp(argv[n], "-w") && n + 1 < argc)
+            record = argv[++n];
+        else if (!strcmp(argv[n], "-b") && n + 1 < argc)
+            compare = argv[++n];
+        else if (!strcmp(argv[n], "-t") && n + 1 < argc)
+            threshold = atof(argv[++n]);
+        else {
+            fprintf(stderr, "usage: %s [-f filter] [-w baseline] [-b baseline] [-t percent]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::map<std::string, double> baseline;
+    if (compare)
+        baseline = LoadBaseline(compare);
+
+    FILE *out = nullptr;
+    if (record) {
+        out = fopen(record, "w");
+        if (!out) {
+            perror(record);
+            return 2;
+        }
+        fprintf(out, "# name ns/unit cycles/unit\n");
+    }
+
+    int regressions = 0;
+    printf("%-20s %10s %12s  %s\n", "benchmark", "ns", "cycles", "unit");
+    for (auto &bench : benches) {
+        if (filter && !strstr(bench.name, filter))
+            continue;
+        auto r = Measure(bench);
+        printf("%-20s %10.2f %12.1f  /%s", bench.name, r.ns, r.cycles, bench.unit);
+        auto base = baseline.find(bench.name);
+        if (base != baseline.end()) {
+            double delta = (r.ns - base->second) * 100 / base->second;
+            printf("  %+6.1f%%", delta);
+            if (delta > threshold) {
+                printf(" REGRESSION");
+                regressions++;
+            }
+        }
+        printf("\n");
+        if (out)
+            fprintf(out, "%s %.3f %.1f\n", bench.name, r.ns, r.cycles);
+    }
+
+    if (out)
+        fclose(out);
+    return regressions ? 1 : 0;
+}
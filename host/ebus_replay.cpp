@@ -0,0 +1,205 @@
+// Replays eBUS traffic through the real EbusBusUart parser and device
+// models on the host, for profiling with perf and the sanitizers.
+//
+//   ebus_replay [-n cycles] [-v] [capture.txt]
+//
+// A capture is hex bytes as seen on the wire (SYN and escapes included),
+// '#' starts a comment. Each line is handed to the parser as one uart
+// burst, so a line has to end where one of our devices answers. Without a
+// capture a synthetic cycle of foreign, broadcast and emulated slave
+// traffic is used.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <vector>
+
+typedef std::vector<std::vector<uint8_t>> Bursts;
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/timers.h"
+#include "esp_log.h"
+
+#include "ebus.h"
+#include "ebus_dev.h"
+#include "ebus_device.h"
+#include "ebus_stream.h"
+#include "ebus_log.h"
+
+static void AppendWire(std::vector<uint8_t> &wire, const uint8_t *data, int len)
+{
+    for (int n = 0; n < len; n++) {
+        auto c = data[n];
+        if (c == ESC || c == SYN) {
+            wire.push_back(ESC);
+            c = c == ESC ? 0 : 1;
+        }
+        wire.push_back(c);
+    }
+}
+
+static void AppendMessage(std::vector<uint8_t> &wire, EbusMessage &msg)
+{
+    msg.SetCRC();
+    AppendWire(wire, msg.GetBuffer(), msg.GetBufferLength());
+}
+
+static Bursts SyntheticCycle()
+{
+    Bursts bursts(3);
+    auto &wire = bursts[0];
+
+    // foreign master-slave, the response is on the wire
+    EbusMessage foreign(0x10, 0x26, 0xb509);
+    foreign.AddPayload(0x0d);
+    foreign.AddPayloadWord(0x0015);
+    AppendMessage(wire, foreign);
+    wire.push_back(ACK);
+    EbusResponse foreignResp;
+    foreignResp.AddPayloadData2c(EbusFixed::FromFloat(45.5f));
+    foreignResp.AddPayload(0xaa);
+    foreignResp.SetCRC();
+    AppendWire(wire, foreignResp.GetBuffer(), foreignResp.GetBufferLength());
+    wire.push_back(ACK);
+    wire.push_back(SYN);
+
+    // broadcast date/time
+    EbusMessage bcast(0x10, BROADCAST_ADDR, 0xb516);
+    const uint8_t dt[] = {0x00, 0x46, 0x10, 0x15, 0x05, 0x09, 0x04, 0x24};
+    for (auto c : dt)
+        bcast.AddPayload(c);
+    AppendMessage(wire, bcast);
+    wire.push_back(SYN);
+
+    // our BAI status, ACK and response come from the echo
+    EbusMessage bai(0x10, 0x08, 0xb511);
+    bai.AddPayload(0x01);
+    AppendMessage(bursts[0], bai);
+    bursts[1].push_back(ACK);
+    bursts[1].push_back(SYN);
+
+    // our VR91 identification
+    EbusMessage id(0x10, 0x35, 0x0704);
+    AppendMessage(bursts[1], id);
+    bursts[2].push_back(ACK);
+    bursts[2].push_back(SYN);
+
+    bursts[2].push_back(SYN);
+    return bursts;
+}
+
+static bool LoadCapture(const char *path, Bursts &bursts)
+{
+    std::vector<uint8_t> wire;
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    int c, nibbles = 0;
+    uint8_t v = 0;
+    while ((c = fgetc(f)) != EOF) {
+        if (c == '#') {
+            while ((c = fgetc(f)) != EOF && c != '\n');
+        }
+        if (c == '\n' || c == EOF) {
+            if (!wire.empty())
+                bursts.push_back(wire);
+            wire.clear();
+            if (c == EOF)
+                break;
+            continue;
+        }
+        int d;
+        if (c >= '0' && c <= '9') d = c - '0';
+        else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') d = c - 'A' + 10;
+        else continue;
+        v = (v << 4) | d;
+        if (++nibbles == 2) {
+            wire.push_back(v);
+            nibbles = 0;
+        }
+    }
+    if (!wire.empty())
+        bursts.push_back(wire);
+    fclose(f);
+    return true;
+}
+
+struct Replay
+{
+    Bursts cycle;
+    size_t bytes;
+    long remaining;
+};
+
+static bool ReplaySource(uart_port_t port, void *ctx)
+{
+    auto replay = (Replay*)ctx;
+    // stands in for the log task
+    EbusLogDrain();
+    if (replay->remaining-- <= 0)
+        return false;
+    for (auto &burst : replay->cycle)
+        host_uart_feed(port, burst.data(), burst.size());
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    Replay replay;
+    replay.remaining = 100000;
+    bool verbose = false;
+    const char *capture = nullptr;
+
+    for (int n = 1; n < argc; n++) {
+        if (!strcmp(argv[n], "-n") && n + 1 < argc)
+            replay.remaining = atol(argv[++n]);
+        else if (!strcmp(argv[n], "-v"))
+            verbose = true;
+        else
+            capture = argv[n];
+    }
+
+    if (capture) {
+        if (!LoadCapture(capture, replay.cycle))
+            return 1;
+    } else {
+        replay.cycle = SyntheticCycle();
+    }
+    replay.bytes = 0;
+    for (auto &burst : replay.cycle)
+        replay.bytes += burst.size();
+
+    if (!verbose) {
+        // the log task prints every frame
+        freopen("/dev/null", "w", stdout);
+    } else {
+        host_log_level = ESP_LOG_INFO;
+    }
+
+    auto bus = new EbusBusUart(UART_NUM_0);
+    bus->AddDevice(CreateBAI(bus, 1));
+    bus->AddDevice(CreateVR91Device(1, bus));
+    bus->AddDevice(CreateVR70Device(0));
+
+    long cycles = replay.remaining;
+    host_uart_set_source(UART_NUM_0, ReplaySource, &replay);
+    // creates the SYN timer, the task itself is run below
+    bus->start();
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    bus->ebusTaskCallback();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    double bytes = (double)cycles * replay.bytes + host_uart_tx_count(UART_NUM_0);
+    fprintf(stderr, "%ld cycles, %.0f bytes in %.3fs: %.0f bytes/s, %.1f ns/byte\n",
+        cycles, bytes, secs, bytes / secs, secs * 1e9 / bytes);
+    return 0;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Just enough of argtable3 for the console command tables to compile,
+// nothing is parsed on the host.
+
+struct arg_int { int count; int *ival; };
+struct arg_dbl { int count; double *dval; };
+struct arg_str { int count; const char **sval; };
+struct arg_end { int count; };
+
+struct arg_int *arg_int0(const char *shortopts, const char *longopts, const char *datatype, const char *glossary);
+struct arg_int *arg_int1(const char *shortopts, const char *longopts, const char *datatype, const char *glossary);
+struct arg_dbl *arg_dbl0(const char *shortopts, const char *longopts, const char *datatype, const char *glossary);
+struct arg_dbl *arg_dbl1(const char *shortopts, const char *longopts, const char *datatype, const char *glossary);
+struct arg_str *arg_str0(const char *shortopts, const char *longopts, const char *datatype, const char *glossary);
+struct arg_str *arg_str1(const char *shortopts, const char *longopts, const char *datatype, const char *glossary);
+struct arg_end *arg_end(int maxcount);
+
+int arg_parse(int argc, char **argv, void **argtable);
+void arg_print_errors(FILE *fp, struct arg_end *end, const char *progname);
+
+#ifdef __cplusplus
+}
+#endif
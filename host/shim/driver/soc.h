@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+#include "sdkconfig.h"
+
+// the CPU cycle counter, from the monotonic clock at the configured CPU frequency
+static inline uint32_t soc_get_ccount(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t ns = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    return (uint32_t)(ns * CONFIG_ESP8266_DEFAULT_CPU_FREQ_MHZ / 1000);
+}
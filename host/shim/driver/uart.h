@@ -0,0 +1,33 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+    UART_NUM_0 = 0,
+    UART_NUM_1,
+    UART_NUM_MAX
+} uart_port_t;
+
+int uart_read_bytes(uart_port_t uart_num, uint8_t *buf, uint32_t length, TickType_t ticks_to_wait);
+int uart_tx_chars(uart_port_t uart_num, const char *buffer, uint32_t len);
+esp_err_t uart_get_buffered_data_len(uart_port_t uart_num, size_t *size);
+
+// Host only. The port behaves like the eBUS wire: transmitted bytes are
+// echoed back ahead of any pending input. Each feed is one burst, the
+// buffered length never reaches past it, so a reply sent at the end of a
+// burst comes back before the next one. When the input runs dry the
+// source callback is asked for more, if it returns false reads fail.
+typedef bool (*host_uart_source_t)(uart_port_t uart_num, void *ctx);
+
+void host_uart_feed(uart_port_t uart_num, const uint8_t *data, size_t len);
+void host_uart_set_source(uart_port_t uart_num, host_uart_source_t source, void *ctx);
+uint32_t host_uart_tx_count(uart_port_t uart_num);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,8 @@
+#pragma once
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+#define ESP_ERROR_CHECK(x) do { esp_err_t __err_rc = (x); (void)__err_rc; } while(0)
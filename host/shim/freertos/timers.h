@@ -0,0 +1,25 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct host_timer *TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t);
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t reload,
+    void *id, TimerCallbackFunction_t cb);
+void *pvTimerGetTimerID(TimerHandle_t timer);
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t wait);
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait);
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t wait);
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait);
+
+// host only: run the timer callback now
+void host_timer_fire(TimerHandle_t timer);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include <deque>
+#include <mutex>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "driver/uart.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_console.h"
+#include "argtable3/argtable3.h"
+
+// time
+
+static uint64_t host_now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static const uint64_t host_start_us = host_now_us();
+
+uint32_t esp_log_timestamp(void)
+{
+    return (uint32_t)((host_now_us() - host_start_us) / 1000);
+}
+
+uint32_t esp_log_early_timestamp(void)
+{
+    return esp_log_timestamp();
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return (int64_t)(host_now_us() - host_start_us);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return esp_log_timestamp() / portTICK_PERIOD_MS;
+}
+
+// log
+
+esp_log_level_t host_log_level = ESP_LOG_WARN;
+
+void host_log_write(esp_log_level_t level, const char *tag, const char *fmt, ...)
+{
+    static const char letters[] = "NEWIDV";
+    fprintf(stderr, "%c (%u) %s: ", letters[level], esp_log_timestamp(), tag);
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+// critical sections
+
+static std::recursive_mutex host_critical;
+
+void vPortEnterCritical(void)
+{
+    host_critical.lock();
+}
+
+void vPortExitCritical(void)
+{
+    host_critical.unlock();
+}
+
+// tasks
+
+struct host_task
+{
+    TaskFunction_t fn;
+    void *arg;
+};
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+    UBaseType_t prio, TaskHandle_t *handle)
+{
+    auto task = new host_task{fn, arg};
+    if (handle)
+        *handle = task;
+    return pdPASS;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait)
+{
+    return 0;
+}
+
+// timers
+
+struct host_timer
+{
+    const char *name;
+    TickType_t period;
+    bool reload;
+    bool active;
+    void *id;
+    TimerCallbackFunction_t cb;
+};
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period, UBaseType_t reload,
+    void *id, TimerCallbackFunction_t cb)
+{
+    return new host_timer{name, period, !!reload, false, id, cb};
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+    return timer->id;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t wait)
+{
+    timer->active = true;
+    return pdPASS;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t wait)
+{
+    timer->active = false;
+    return pdPASS;
+}
+
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t wait)
+{
+    timer->active = true;
+    return pdPASS;
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t wait)
+{
+    timer->period = period;
+    timer->active = true;
+    return pdPASS;
+}
+
+void host_timer_fire(TimerHandle_t timer)
+{
+    timer->cb(timer);
+    if (!timer->reload)
+        timer->active = false;
+}
+
+// uart
+
+struct host_uart
+{
+    std::deque<uint8_t> echo;
+    std::deque<uint8_t> rx;
+    std::deque<size_t> bursts;  // rx as it was fed
+    host_uart_source_t source = nullptr;
+    void *ctx = nullptr;
+    uint32_t txCount = 0;
+    // our own bytes were read last, nobody else talks until we're done
+    bool echoing = false;
+    // a fed burst was read to its end, the next one comes later
+    bool burstEnded = false;
+};
+
+static host_uart host_uarts[UART_NUM_MAX];
+
+int uart_read_bytes(uart_port_t uart_num, uint8_t *buf, uint32_t length, TickType_t ticks_to_wait)
+{
+    auto &uart = host_uarts[uart_num];
+    uint32_t n = 0;
+    while (n < length && !uart.echo.empty()) {
+        buf[n++] = uart.echo.front();
+        uart.echo.pop_front();
+    }
+    uart.echoing = n > 0;
+    if (n)
+        return n;
+    while (uart.rx.empty()) {
+        if (!uart.source || !uart.source(uart_num, uart.ctx))
+            return -1;
+    }
+    uart.burstEnded = false;
+    while (n < length && !uart.rx.empty()) {
+        buf[n++] = uart.rx.front();
+        uart.rx.pop_front();
+        if (--uart.bursts.front() == 0) {
+            uart.bursts.pop_front();
+            uart.burstEnded = true;
+            break;
+        }
+    }
+    return n;
+}
+
+esp_err_t uart_get_buffered_data_len(uart_port_t uart_num, size_t *size)
+{
+    auto &uart = host_uarts[uart_num];
+    if (!uart.echo.empty())
+        *size = uart.echo.size();
+    else if (uart.echoing || uart.burstEnded)
+        *size = 0;
+    else
+        *size = uart.bursts.empty() ? 0 : uart.bursts.front();
+    return ESP_OK;
+}
+
+int uart_tx_chars(uart_port_t uart_num, const char *buffer, uint32_t len)
+{
+    auto &uart = host_uarts[uart_num];
+    // half duplex bus, our own bytes come straight back
+    uart.echo.insert(uart.echo.end(), (const uint8_t*)buffer, (const uint8_t*)buffer + len);
+    uart.txCount += len;
+    return len;
+}
+
+void host_uart_feed(uart_port_t uart_num, const uint8_t *data, size_t len)
+{
+    auto &uart = host_uarts[uart_num];
+    if (!len)
+        return;
+    uart.rx.insert(uart.rx.end(), data, data + len);
+    uart.bursts.push_back(len);
+}
+
+void host_uart_set_source(uart_port_t uart_num, host_uart_source_t source, void *ctx)
+{
+    host_uarts[uart_num].source = source;
+    host_uarts[uart_num].ctx = ctx;
+}
+
+uint32_t host_uart_tx_count(uart_port_t uart_num)
+{
+    return host_uarts[uart_num].txCount;
+}
+
+// console
+
+esp_err_t esp_console_cmd_register(const esp_console_cmd_t *cmd)
+{
+    return ESP_OK;
+}
+
+struct arg_int *arg_int0(const char *shortopts, const char *longopts, const char *datatype, const char *glossary)
+{
+    return new arg_int{0, new int[1]{0}};
+}
+
+struct arg_int *arg_int1(const char *shortopts, const char *longopts, const char *datatype, const char *glossary)
+{
+    return arg_int0(shortopts, longopts, datatype, glossary);
+}
+
+struct arg_dbl *arg_dbl0(const char *shortopts, const char *longopts, const char *datatype, const char *glossary)
+{
+    return new arg_dbl{0, new double[1]{0}};
+}
+
+struct arg_dbl *arg_dbl1(const char *shortopts, const char *longopts, const char *datatype, const char *glossary)
+{
+    return arg_dbl0(shortopts, longopts, datatype, glossary);
+}
+
+struct arg_str *arg_str0(const char *shortopts, const char *longopts, const char *datatype, const char *glossary)
+{
+    return new arg_str{0, new const char*[1]{""}};
+}
+
+struct arg_str *arg_str1(const char *shortopts, const char *longopts, const char *datatype, const char *glossary)
+{
+    return arg_str0(shortopts, longopts, datatype, glossary);
+}
+
+struct arg_end *arg_end(int maxcount)
+{
+    auto end = new struct arg_end;
+    end->count = 0;
+    return end;
+}
+
+int arg_parse(int argc, char **argv, void **argtable)
+{
+    return 0;
+}
+
+void arg_print_errors(FILE *fp, struct arg_end *end, const char *progname)
+{
+}
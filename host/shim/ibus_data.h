@@ -0,0 +1,4 @@
+#pragma once
+
+// flash placement attribute, tables live in ordinary rodata on the host
+#define ESP_IBUS_ATTR
@@ -0,0 +1,4 @@
+#pragma once
+// Host build stand-in for the generated sdkconfig.h, values from ../sdkconfig
+
+#define CONFIG_ESP8266_DEFAULT_CPU_FREQ_MHZ 160
@@ -1,5 +1,6 @@
 #include "stdint.h"
 #include <stdbool.h>
+#include <string.h>
 #include "ebus.h"
 
 #define USING_IBUS_FASTER_GET
@@ -9,7 +10,7 @@
 /**
  * CRC8 lookup table for the polynom 0x9b = x^8 + x^7 + x^4 + x^3 + x^1 + 1.
  */
-static const uint8_t CRC_LOOKUP_TABLE[] ESP_IBUS_ATTR = {
+static const uint8_t CRC_LOOKUP_TABLE[] ESP_IBUS_ATTR __attribute__((aligned(4))) = {
   0x00, 0x9b, 0xad, 0x36, 0xc1, 0x5a, 0x6c, 0xf7, 0x19, 0x82, 0xb4, 0x2f, 0xd8, 0x43, 0x75, 0xee,
   0x32, 0xa9, 0x9f, 0x04, 0xf3, 0x68, 0x5e, 0xc5, 0x2b, 0xb0, 0x86, 0x1d, 0xea, 0x71, 0x47, 0xdc,
   0x64, 0xff, 0xc9, 0x52, 0xa5, 0x3e, 0x08, 0x93, 0x7d, 0xe6, 0xd0, 0x4b, 0xbc, 0x27, 0x11, 0x8a,
@@ -28,23 +29,242 @@ static const uint8_t CRC_LOOKUP_TABLE[] ESP_IBUS_ATTR = {
   0x95, 0x0e, 0x38, 0xa3, 0x54, 0xcf, 0xf9, 0x62, 0x8c, 0x17, 0x21, 0xba, 0x4d, 0xd6, 0xe0, 0x7b,
 };
 
+/**
+ * The two bytes of an escape pair in one go, ESC then 0: the row of the row
+ * of crc ^ ESC. For SYN, the 1 of its pair flips the lowest bit.
+ */
+static const uint8_t CRC_ESCAPE_TABLE[] ESP_IBUS_ATTR __attribute__((aligned(4))) = {
+  0xed, 0xfb, 0xc1, 0xd7, 0xb5, 0xa3, 0x99, 0x8f, 0x5d, 0x4b, 0x71, 0x67, 0x05, 0x13, 0x29, 0x3f,
+  0x16, 0x00, 0x3a, 0x2c, 0x4e, 0x58, 0x62, 0x74, 0xa6, 0xb0, 0x8a, 0x9c, 0xfe, 0xe8, 0xd2, 0xc4,
+  0x80, 0x96, 0xac, 0xba, 0xd8, 0xce, 0xf4, 0xe2, 0x30, 0x26, 0x1c, 0x0a, 0x68, 0x7e, 0x44, 0x52,
+  0x7b, 0x6d, 0x57, 0x41, 0x23, 0x35, 0x0f, 0x19, 0xcb, 0xdd, 0xe7, 0xf1, 0x93, 0x85, 0xbf, 0xa9,
+  0x37, 0x21, 0x1b, 0x0d, 0x6f, 0x79, 0x43, 0x55, 0x87, 0x91, 0xab, 0xbd, 0xdf, 0xc9, 0xf3, 0xe5,
+  0xcc, 0xda, 0xe0, 0xf6, 0x94, 0x82, 0xb8, 0xae, 0x7c, 0x6a, 0x50, 0x46, 0x24, 0x32, 0x08, 0x1e,
+  0x5a, 0x4c, 0x76, 0x60, 0x02, 0x14, 0x2e, 0x38, 0xea, 0xfc, 0xc6, 0xd0, 0xb2, 0xa4, 0x9e, 0x88,
+  0xa1, 0xb7, 0x8d, 0x9b, 0xf9, 0xef, 0xd5, 0xc3, 0x11, 0x07, 0x3d, 0x2b, 0x49, 0x5f, 0x65, 0x73,
+  0xc2, 0xd4, 0xee, 0xf8, 0x9a, 0x8c, 0xb6, 0xa0, 0x72, 0x64, 0x5e, 0x48, 0x2a, 0x3c, 0x06, 0x10,
+  0x39, 0x2f, 0x15, 0x03, 0x61, 0x77, 0x4d, 0x5b, 0x89, 0x9f, 0xa5, 0xb3, 0xd1, 0xc7, 0xfd, 0xeb,
+  0xaf, 0xb9, 0x83, 0x95, 0xf7, 0xe1, 0xdb, 0xcd, 0x1f, 0x09, 0x33, 0x25, 0x47, 0x51, 0x6b, 0x7d,
+  0x54, 0x42, 0x78, 0x6e, 0x0c, 0x1a, 0x20, 0x36, 0xe4, 0xf2, 0xc8, 0xde, 0xbc, 0xaa, 0x90, 0x86,
+  0x18, 0x0e, 0x34, 0x22, 0x40, 0x56, 0x6c, 0x7a, 0xa8, 0xbe, 0x84, 0x92, 0xf0, 0xe6, 0xdc, 0xca,
+  0xe3, 0xf5, 0xcf, 0xd9, 0xbb, 0xad, 0x97, 0x81, 0x53, 0x45, 0x7f, 0x69, 0x0b, 0x1d, 0x27, 0x31,
+  0x75, 0x63, 0x59, 0x4f, 0x2d, 0x3b, 0x01, 0x17, 0xc5, 0xd3, 0xe9, 0xff, 0x9d, 0x8b, 0xb1, 0xa7,
+  0x8e, 0x98, 0xa2, 0xb4, 0xd6, 0xc0, 0xfa, 0xec, 0x3e, 0x28, 0x12, 0x04, 0x66, 0x70, 0x4a, 0x5c,
+};
+
+// tables in flash only take aligned word reads on the ESP8266
+static inline uint8_t crc_table_get(const uint8_t *table, uint8_t i)
+{
+#ifdef __linux__
+    return table[i];
+#else
+    return ((const uint32_t *)table)[i >> 2] >> ((i & 3) * 8);
+#endif
+}
+
 uint8_t __attribute__((optimize("O3")))  _CRC_LOOKUP_TABLE(uint8_t crc)
 {
-    //return ESP_IBUS_GET_U8_DATA(crc, CRC_LOOKUP_TABLE);
-    return (((uint32_t*)CRC_LOOKUP_TABLE)[crc/4]) >> ((crc & 3) *8);
+    return crc_table_get(CRC_LOOKUP_TABLE, crc);
+}
+
+// fold one unescaped byte into the crc, SYN and ESC are counted as their escape pair
+static inline uint8_t crc_update(uint8_t crc, uint8_t c)
+{
+    if (c == ESC)
+        return crc_table_get(CRC_ESCAPE_TABLE, crc);
+    if (c == SYN)
+        return crc_table_get(CRC_ESCAPE_TABLE, crc) ^ 1;
+    return crc_table_get(CRC_LOOKUP_TABLE, crc) ^ c;
+}
+
+uint8_t crc8v_update(uint8_t crc, uint8_t c)
+{
+    return crc_update(crc, c);
+}
+
+// fold one byte as it is on the wire, escapes already applied
+uint8_t crc8v_fold(uint8_t crc, uint8_t c)
+{
+    return crc_table_get(CRC_LOOKUP_TABLE, crc) ^ c;
+}
+
+#ifdef __linux__
+/**
+ * Slice by 4 for the host tools: the table is linear, so four bytes
+ * without SYN or ESC fold as row^4(crc) ^ row^3(b0) ^ row^2(b1) ^ row(b2) ^ b3,
+ * four independent lookups instead of a chain of four.
+ */
+static uint8_t crc_slice[4][256];
+
+__attribute__((constructor)) static void crc_slice_init(void)
+{
+    for (int n = 0; n < 256; n++) {
+        uint8_t c = n;
+        for (int k = 0; k < 4; k++) {
+            c = CRC_LOOKUP_TABLE[c];
+            crc_slice[k][n] = c;
+        }
+    }
+}
+
+// any byte of w SYN or ESC
+static inline bool crc_has_special(uint32_t w)
+{
+    uint32_t esc = w ^ 0xa9a9a9a9;
+    uint32_t syn = w ^ 0xaaaaaaaa;
+    return (((esc - 0x01010101) & ~esc) | ((syn - 0x01010101) & ~syn)) & 0x80808080;
 }
 
 // CRC-8-WCDMA poly-0x9B
 uint8_t crc8v(const uint8_t *buf, int len)
 {
     uint8_t crc = 0;
-    while(len--) {
-        char c = *buf++;
-        if ( c == ESC || c == SYN) {
-            c = c==ESC ? 0 : 1;
-            crc = _CRC_LOOKUP_TABLE(crc) ^ ESC;
+    while (len >= 4) {
+        uint32_t w;
+        memcpy(&w, buf, 4);
+        if (crc_has_special(w)) {
+            for (int n = 0; n < 4; n++)
+                crc = crc_update(crc, buf[n]);
+        } else {
+            crc = crc_slice[3][crc] ^ crc_slice[2][buf[0]] ^ crc_slice[1][buf[1]] ^
+                crc_slice[0][buf[2]] ^ buf[3];
         }
-        crc = _CRC_LOOKUP_TABLE(crc) ^ c;
+        buf += 4;
+        len -= 4;
     }
+    while (len--)
+        crc = crc_update(crc, *buf++);
+    return crc;
+}
+#else
+// CRC-8-WCDMA poly-0x9B
+uint8_t crc8v(const uint8_t *buf, int len)
+{
+    uint8_t crc = 0;
+    while(len--)
+        crc = crc_update(crc, *buf++);
     return crc;
 }
+#endif
+
+#if defined(__linux__) && defined(__x86_64__)
+#include <immintrin.h>
+
+#define CRC_BATCH_LANES 16
+#define CRC_BATCH_COLUMNS 32
+
+/**
+ * Sixteen frames side by side in the bytes of an SSE register. The rows
+ * are linear, row(x) = row(x & 15) ^ row(x & 0xf0), so pshufb looks up
+ * both nibble halves for all frames at once. Escape pairs are
+ * row^2(x) ^ row(ESC), the same way.
+ */
+static uint8_t crc_nibbles[4][16] __attribute__((aligned(16)));
+
+__attribute__((constructor)) static void crc_nibbles_init(void)
+{
+    for (int n = 0; n < 16; n++) {
+        crc_nibbles[0][n] = CRC_LOOKUP_TABLE[n];
+        crc_nibbles[1][n] = CRC_LOOKUP_TABLE[n << 4];
+        crc_nibbles[2][n] = CRC_LOOKUP_TABLE[CRC_LOOKUP_TABLE[n]];
+        crc_nibbles[3][n] = CRC_LOOKUP_TABLE[CRC_LOOKUP_TABLE[n << 4]];
+    }
+}
+
+// 16x16 bytes, register n byte m to register m byte n: each round rotates
+// the 8 bits of register and byte index left by one
+static inline void crc_transpose(__m128i r[16])
+{
+    for (int round = 0; round < 4; round++) {
+        __m128i t[16];
+        for (int n = 0; n < 8; n++) {
+            t[2 * n] = _mm_unpacklo_epi8(r[n], r[n + 8]);
+            t[2 * n + 1] = _mm_unpackhi_epi8(r[n], r[n + 8]);
+        }
+        for (int n = 0; n < 16; n++)
+            r[n] = t[n];
+    }
+}
+
+// false when a frame is too long for the tile, those go one by one
+__attribute__((target("ssse3")))
+static bool crc8v_batch16(const uint8_t *frames, int stride, const uint8_t *lens, uint8_t *crcs)
+{
+    int longest = 0;
+    for (int n = 0; n < CRC_BATCH_LANES; n++) {
+        if (lens[n] > CRC_BATCH_COLUMNS)
+            return false;
+        if (lens[n] > longest)
+            longest = lens[n];
+    }
+    // rows are read in place while the 16 bytes stay inside the stride,
+    // bytes past a frame's end are masked out below; the last row only
+    // goes as far as its own length
+    int blocks = (longest + 15) & ~15;
+    int direct = blocks <= stride ? CRC_BATCH_LANES - 1 : 0;
+    uint8_t tile[CRC_BATCH_LANES][CRC_BATCH_COLUMNS] __attribute__((aligned(16)));
+    for (int n = direct; n < CRC_BATCH_LANES; n++) {
+        memcpy(tile[n], frames + n * stride, lens[n]);
+        memset(tile[n] + lens[n], 0, CRC_BATCH_COLUMNS - lens[n]);
+    }
+
+    // byte i of every frame
+    __m128i columns[CRC_BATCH_COLUMNS];
+    for (int block = 0; block < longest; block += 16) {
+        __m128i r[16];
+        for (int n = 0; n < 16; n++)
+            r[n] = n < direct ? _mm_loadu_si128((const __m128i *)(frames + n * stride + block)) :
+                _mm_load_si128((const __m128i *)&tile[n][block]);
+        crc_transpose(r);
+        for (int n = 0; n < 16; n++)
+            columns[block + n] = r[n];
+    }
+
+    const __m128i rowLo = _mm_load_si128((const __m128i *)crc_nibbles[0]);
+    const __m128i rowHi = _mm_load_si128((const __m128i *)crc_nibbles[1]);
+    const __m128i escLo = _mm_load_si128((const __m128i *)crc_nibbles[2]);
+    const __m128i escHi = _mm_load_si128((const __m128i *)crc_nibbles[3]);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i esc = _mm_set1_epi8((char)ESC);
+    const __m128i syn = _mm_set1_epi8((char)SYN);
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i escRow = _mm_set1_epi8((char)CRC_LOOKUP_TABLE[ESC]);
+    const __m128i remaining = _mm_loadu_si128((const __m128i *)lens);
+
+    __m128i crc = _mm_setzero_si128();
+    for (int i = 0; i < longest; i++) {
+        __m128i c = columns[i];
+        __m128i lo = _mm_and_si128(crc, nibble);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(crc, 4), nibble);
+        __m128i plain = _mm_xor_si128(_mm_xor_si128(_mm_shuffle_epi8(rowLo, lo), _mm_shuffle_epi8(rowHi, hi)), c);
+        __m128i isSyn = _mm_cmpeq_epi8(c, syn);
+        __m128i special = _mm_or_si128(isSyn, _mm_cmpeq_epi8(c, esc));
+        __m128i escaped = _mm_xor_si128(_mm_xor_si128(_mm_shuffle_epi8(escLo, lo), _mm_shuffle_epi8(escHi, hi)),
+            _mm_xor_si128(escRow, _mm_and_si128(isSyn, one)));
+        __m128i next = _mm_or_si128(_mm_and_si128(special, escaped), _mm_andnot_si128(special, plain));
+        // frames shorter than i keep their crc
+        __m128i done = _mm_cmpeq_epi8(_mm_subs_epu8(remaining, _mm_set1_epi8((char)i)), _mm_setzero_si128());
+        crc = _mm_or_si128(_mm_and_si128(done, crc), _mm_andnot_si128(done, next));
+    }
+    _mm_storeu_si128((__m128i *)crcs, crc);
+    return true;
+}
+#endif
+
+// crcs[n] = crc8v of the lens[n] bytes at frames + n * stride
+void crc8v_batch(const uint8_t *frames, int stride, const uint8_t *lens, uint8_t *crcs, int count)
+{
+    int n = 0;
+#if defined(__linux__) && defined(__x86_64__)
+    if (__builtin_cpu_supports("ssse3")) {
+        for (; n + CRC_BATCH_LANES <= count; n += CRC_BATCH_LANES) {
+            if (crc8v_batch16(frames + n * stride, stride, lens + n, crcs + n))
+                continue;
+            for (int k = n; k < n + CRC_BATCH_LANES; k++)
+                crcs[k] = crc8v(frames + k * stride, lens[k]);
+        }
+    }
+#endif
+    for (; n < count; n++)
+        crcs[n] = crc8v(frames + n * stride, lens[n]);
+}
@@ -8,6 +8,9 @@
 #define EBUS_HEADER_SIZE 5
 #define EBUS_CRC_SIZE 1
 
+// 2400 baud, 10 bits a byte
+#define EBUS_BYTE_US 4167
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -15,7 +18,18 @@ extern "C" {
 
 void start_ebus_task();
 
+// address classes, indexed by address
+#define EBUS_ADDR_SLAVE 0
+#define EBUS_ADDR_MASTER 1
+#define EBUS_ADDR_BROADCAST 2
+#define EBUS_ADDR_INVALID 3 // SYN and ESC
+extern const uint8_t EBUS_ADDR_CLASS[256];
+
 uint8_t crc8v(const uint8_t *buf, int len);
+uint8_t crc8v_update(uint8_t crc, uint8_t c);
+uint8_t crc8v_fold(uint8_t crc, uint8_t c);
+// frame n is lens[n] bytes at frames + n * stride, for checking captures offline
+void crc8v_batch(const uint8_t *frames, int stride, const uint8_t *lens, uint8_t *crcs, int count);
 bool IS_MASTER(uint8_t c);
 
 #ifdef __cplusplus
@@ -9,6 +9,7 @@
 
 #include "ebus_dev.h"
 #include "ebus_device.h"
+#include "ebus_schema.h"
 
 #include "esp_log.h"
 #include "argtable3/argtable3.h"
@@ -28,11 +29,29 @@ enum class StateCode : uint8_t {
      };
 enum class DisableFlags { None=0, CH=1, DHWtapping=2, DHWloading=4, };
 
+// b504 00: dcfstate, s m h BCD, d m dow y, outside
+typedef EbusSchema<EbusByte, EbusBCD, EbusBCD, EbusBCD, EbusByte, EbusByte, EbusByte, EbusByte,
+    EbusData2b> BaiDateTime;
+// b504 10
+typedef EbusSchema<EbusWord> BaiStatus16;
+// b510 00: id, hc mode, hc flow, hwc, hwc flow, ?, flags, ?, remote
+typedef EbusSchema<EbusByte, EbusByte, EbusData1c, EbusData1c, EbusByte, EbusByte, EbusByte, EbusByte,
+    EbusByte> BaiSetMode;
+// b511 00: flow, pressure*10, ?, state, bits, errors, running
+typedef EbusSchema<EbusData2c, EbusByte, EbusByte, EbusByte, EbusByte, EbusByte, EbusByte> BaiStatus0;
+// b511 01: flow, return, outside, hwc, storage, pump, ?, ?
+typedef EbusSchema<EbusData1c, EbusData1c, EbusData2b, EbusData1c, EbusData1c, EbusByte, EbusByte,
+    EbusByte> BaiStatus1;
+// b511 02: hwc mode, t0, t1, t0, storage desired
+typedef EbusSchema<EbusByte, EbusByte, EbusData1c, EbusByte, EbusData1c> BaiStatus2;
+// b516 11: unknown, always the same
+static constexpr EbusConstFrame baiUnknown16 = EbusMakeResponse(0);
+
 class EbusDeviceBoiler : public EbusDeviceBase
 {
     // inputs
-    float tempDesired, hwcDesired;
-    float stgDesired;
+    EbusFixed tempDesired, hwcDesired;
+    EbusFixed stgDesired;
     HcMode hcMode;
     HwcMode hwcMode;
     DisableFlags disableFlags;
@@ -40,11 +59,11 @@ class EbusDeviceBoiler : public EbusDeviceBase
     uint8_t cirSpeed;
 
     // sensors
-    float flowTemp, retTemp;
-    float hwcTemp, hwcFlowTemp;
-    float stgTemp;
-    float outsideTemp;
-    float pressure;
+    EbusFixed flowTemp, retTemp;
+    EbusFixed hwcTemp, hwcFlowTemp;
+    EbusFixed stgTemp;
+    EbusFixed outsideTemp;
+    EbusFixed pressure;
 
     // outputs
     bool fan, gas, pump;
@@ -56,9 +75,9 @@ public:
         : EbusDeviceBase(masterAddr, 0xb5, "BAI00", 0x0500+idx, 0x7401, bus)
     {
         // inputs
-        tempDesired = 0.5;
-        hwcDesired = 1.5;
-        stgDesired = 2.5;
+        tempDesired = EbusFixed::FromFloat(0.5);
+        hwcDesired = EbusFixed::FromFloat(1.5);
+        stgDesired = EbusFixed::FromFloat(2.5);
         disableFlags = DisableFlags::None;
         cirSpeed = 0;
 
@@ -66,186 +85,158 @@ public:
         hwcMode = HwcMode::Auto;
 
         // sensors
-        flowTemp = 71.5;
-        retTemp = 55.5;
-        hwcTemp = 61.5;
-        hwcFlowTemp = 65.5;
-        stgTemp = 63.5;
-        pressure = 1.5;
-        outsideTemp = 13.5;
+        flowTemp = EbusFixed::FromFloat(71.5);
+        retTemp = EbusFixed::FromFloat(55.5);
+        hwcTemp = EbusFixed::FromFloat(61.5);
+        hwcFlowTemp = EbusFixed::FromFloat(65.5);
+        stgTemp = EbusFixed::FromFloat(63.5);
+        pressure = EbusFixed::FromFloat(1.5);
+        outsideTemp = EbusFixed::FromFloat(13.5);
 
         // outputs
         state = StateCode::NoHeatDemand;
         fan = gas = pump = false;
 
+        PublishTemplate(0xb516, 1, 0x11, baiUnknown16);
+        RefreshTemplates();
     }
-    
-    bool ProcessSlaveMessage(EbusMessage const &msg, EbusResponse **response)
+
+    // b504 reads
+    bool WriteRead(uint8_t id, EbusResponse &response)
     {
-        auto cmd = msg.GetCmd();
-        auto data = msg.GetPayload();
-        switch (cmd) {
-            case 0xb504: // read
-                switch(data[0]) {
-                    case 0: // datetime - only primary boiler
-                    {
-                    // 10 08 b504 01 00 / 0a 00 000000ffffffff 000e
-                        auto resp = new EbusResponse();
-                        resp->AddPayload(0); // dcfstate
-                        resp->AddPayload(0); // s
-                        resp->AddPayload(0); // m
-                        resp->AddPayload(0); // h
-                        resp->AddPayload(0xff); // d
-                        resp->AddPayload(0xff); // m
-                        resp->AddPayload(0xff); // d
-                        resp->AddPayload(0xff); // y
-                        resp->AddPayloadData2b(outsideTemp);
-                        *response = resp;
-                        return true;
-                    }
-                    case 0x10: // Status16 - outside
-                        {
-                            auto resp = new EbusResponse();
-                            resp->AddPayloadWord(0xffff);
-                            *response = resp;
-                            return true;
-                        };
-                }
-                break;
-            case 0xb505: // write
-                ESP_LOGI(name, "Write DHW");
-                break;
-            case 0xb510: // Set Mode
-                if (msg.GetPayloadLength() > 0) {
-                    uint8_t id = data[0];
-                    switch(id) {
-                        case 0: // SetMode
-                            if (msg.GetPayloadLength() == 9) {
-                                //   0  1  2  3  4  5  6  7  8
-                                //  00 00 00 76 ff ff 01 00 00
-                                //  00 00 3c 76 ff ff 00 ff 00
-                                //  00 00 ff ff ff ff 05 00 00
-                                // others: SetPointLoadingPump, CHDisableMonitor
-                                auto hcModeSet = data[1];
-                                auto hcTempSet = msg.ReadPayloadData1c(2);
-                                auto hwTempSet = msg.ReadPayloadData1c(3);
-                                auto hwcTempFlowSet = data[4];
-                                // 5 unknown ff
-                                auto flags = data[6]; //
-                                // 7 unknown 00/ff
-                                // bits 0-7: remote control CH pump/release backup heater/release cooling/not used/left stop position DHW o, bits sent in M14 
-                                auto remote = data[8];
-
-                                ESP_LOGI(name, "SetMode hcmode:%d flow:%d hwc:%d flag:%02x", hcModeSet, (int)hcTempSet, (int)hwTempSet, flags);
-
-                                if(!std::isnan(hcTempSet))
-                                    tempDesired = hcTempSet;
-                                if(!std::isnan(hwTempSet))
-                                    hwcDesired = hwTempSet;
-                                hcMode = (HcMode) hcModeSet;
-                                disableFlags = (DisableFlags) flags;
-
-                                auto resp = new EbusResponse();
-                                resp->AddPayload((uint8_t)1); // ack?
-                                *response = resp;
-                                return true;
-                            }
-                    }
-                }
-                break;
-                //return false;
-            case 0xb511: // Read Status
-                if (msg.GetPayloadLength() == 1) {
-                    uint8_t id = data[0];
-                    switch (id) {
-                        case 0:
-                            { // 08 ee010800 1e000000
-                                auto resp = new EbusResponse();
-                                resp->AddPayloadData2c(flowTemp); // flow
-                                resp->AddPayload(pressure*10); // pressure10
-                                resp->AddPayload(0); // unknown
-                                resp->AddPayload((uint8_t)state); // state
-                                resp->AddPayload((fan?1:0)|(gas?6:0)|(pump?8:0)); // bits
-                                resp->AddPayload(0); // errors
-                                resp->AddPayload(0); // running 1=hcDemand 2=Blocked 64/128=hwcDemand?
-                                *response = resp;
-                                return true;
-                            }
-                            break;
-                        case 1:
-                            { // 1008b511010189 00 09 403e000a3c3e0000ff 01 00
-                            // 09 3c38 0007 343a 0000ff
-                                auto resp = new EbusResponse();
-                                resp->AddPayloadData1c(flowTemp); // flow
-                                resp->AddPayloadData1c(retTemp); // return
-                                resp->AddPayloadData2b(outsideTemp); // frc out
-                                resp->AddPayloadData1c(hwcTemp); // hwcTemp
-                                resp->AddPayloadData1c(stgTemp); // storageTemp
-                                resp->AddPayload(1); // pump
-                                resp->AddPayload(0); // unknown
-                                resp->AddPayload(Ebus::BYTE_REPLACEMENT); // unknown
-                                *response = resp;
-                                return true;
-                            }
-                            break;
-                        case 2:
-                            { // 1008b51101028a 00 05 033c864676 2f 00
-                            // 05 03 3c 86 46 76
-                                auto resp = new EbusResponse();
-                                resp->AddPayload((uint8_t)hwcMode); // hwcmode
-                                resp->AddPayload((uint8_t)hwcDesired); // t0
-                                resp->AddPayloadData1c(22.5); // t1
-                                resp->AddPayload((uint8_t)27.5); // t0
-                                resp->AddPayloadData1c(stgDesired); // t1
-                                *response = resp;
-                                return true;
-                            }
-                            break;
-                    }
-                }
-                break;
-                //return false;
-            case 0xb512:
-                { // 1008b512020064 ae00 00 00 00
-                if (msg.GetPayloadLength() > 0) {
-                    uint8_t id = data[0];
-                    switch(id) {
-                        case 0: // circ pump
-                            if (msg.GetPayloadLength() == 2) {
-                                ESP_LOGI(name, "Set circ %02x", data[1]);
-                                cirSpeed = data[1];
-                                auto resp = new EbusResponse();
-                                resp->AddPayload((uint8_t)0); // ack?
-                                *response = resp;
-                                return true;
-                            }
-                            break;
-                        case 4: // unknown
-                            if (msg.GetPayloadLength() == 2) {
-                                ESP_LOGI(name, "Set xxx %02x", data[1]);
-                                auto resp = new EbusResponse();
-                                resp->AddPayload(1); // ?
-                                resp->AddPayload(1); // ?
-                                *response = resp;
-                                return true;
-                            }
-                            break;
-                    }
-                }
-                }
-                break;
-                //return false;
-            case 0xb513:
-                break;
-            case 0xb516: // unknown - simple return
-                auto p = *data;
-                if ( p == 0x11) {
-                    *response = new EbusResponse();
-                    (*response)->AddPayload(0);
-                    return true;
-                }
+        switch(id) {
+            case 0: // datetime - only primary boiler
+            // 10 08 b504 01 00 / 0a 00 000000ffffffff 000e
+                return BaiDateTime::Encode(response, 0, 0, 0, 0, 0xff, 0xff, 0xff, 0xff, outsideTemp);
+            case 0x10: // Status16 - outside
+                return BaiStatus16::Encode(response, 0xffff);
+        }
+        return false;
+    }
 
+    // b511 status blocks
+    bool WriteStatus(uint8_t id, EbusResponse &response)
+    {
+        switch (id) {
+            case 0: // 08 ee010800 1e000000
+                // running 1=hcDemand 2=Blocked 64/128=hwcDemand?
+                return BaiStatus0::Encode(response, flowTemp, pressure.Scaled(10), 0, (uint8_t)state,
+                    (fan?1:0)|(gas?6:0)|(pump?8:0), 0, 0);
+            case 1: // 1008b511010189 00 09 403e000a3c3e0000ff 01 00
+                // 09 3c38 0007 343a 0000ff
+                return BaiStatus1::Encode(response, flowTemp, retTemp, outsideTemp, hwcTemp, stgTemp,
+                    1, 0, Ebus::BYTE_REPLACEMENT);
+            case 2: // 1008b51101028a 00 05 033c864676 2f 00
+                // 05 03 3c 86 46 76
+                return BaiStatus2::Encode(response, (uint8_t)hwcMode, hwcDesired.ToInt(),
+                    EbusFixed::FromFloat(22.5), 27, stgDesired);
+        }
+        return false;
+    }
+
+    // the reads answered without asking us, again after every change
+    void RefreshTemplates()
+    {
+        for (uint8_t id : {0, 0x10}) {
+            EbusResponse response;
+            WriteRead(id, response);
+            PublishTemplate(0xb504, 1, id, response);
         }
+        for (uint8_t id = 0; id < 3; id++) {
+            EbusResponse response;
+            WriteStatus(id, response);
+            PublishTemplate(0xb511, 1, id, response);
+        }
+    }
+
+private:
+    bool Read(EbusMessage const &msg, EbusResponse &response)
+    {
+        return WriteRead(msg.GetPayload()[0], response);
+    }
+
+    bool WriteDhw(EbusMessage const &msg, EbusResponse &response)
+    {
+        ESP_LOGI(name, "Write DHW");
+        return false;
+    }
+
+    bool SetMode(EbusMessage const &msg, EbusResponse &response)
+    {
+        //   0  1  2  3  4  5  6  7  8
+        //  00 00 00 76 ff ff 01 00 00
+        //  00 00 3c 76 ff ff 00 ff 00
+        //  00 00 ff ff ff ff 05 00 00
+        // others: SetPointLoadingPump, CHDisableMonitor
+        uint8_t setId, hcModeSet, hwcTempFlowSet, unknown5, flags, unknown7, remote;
+        EbusFixed hcTempSet, hwTempSet;
+        // 5 unknown ff, 7 unknown 00/ff
+        // remote bits 0-7: remote control CH pump/release backup heater/release cooling/not used/left stop position DHW o, bits sent in M14 
+        if (!BaiSetMode::Decode(msg, setId, hcModeSet, hcTempSet, hwTempSet, hwcTempFlowSet,
+                unknown5, flags, unknown7, remote))
+            return false;
+
+        ESP_LOGI(name, "SetMode hcmode:%d flow:%d hwc:%d flag:%02x", hcModeSet, hcTempSet.ToInt(), hwTempSet.ToInt(), flags);
+
+        if(hcTempSet.IsValid())
+            tempDesired = hcTempSet;
+        if(hwTempSet.IsValid())
+            hwcDesired = hwTempSet;
+        hcMode = (HcMode) hcModeSet;
+        disableFlags = (DisableFlags) flags;
+
+        response.AddPayload((uint8_t)1); // ack?
+        RefreshTemplates();
+        return true;
+    }
+
+    bool ReadStatus(EbusMessage const &msg, EbusResponse &response)
+    {
+        return WriteStatus(msg.GetPayload()[0], response);
+    }
+
+    // 1008b512020064 ae00 00 00 00
+    bool SetCirculation(EbusMessage const &msg, EbusResponse &response)
+    {
+        auto data = msg.GetPayload();
+        ESP_LOGI(name, "Set circ %02x", data[1]);
+        cirSpeed = data[1];
+        response.AddPayload((uint8_t)0); // ack?
+        return true;
+    }
+
+    bool SetUnknown4(EbusMessage const &msg, EbusResponse &response)
+    {
+        ESP_LOGI(name, "Set xxx %02x", msg.GetPayload()[1]);
+        response.AddPayload(1); // ?
+        response.AddPayload(1); // ?
+        return true;
+    }
+
+    // unknown - simple return
+    bool ReadUnknown16(EbusMessage const &msg, EbusResponse &response)
+    {
+        response = EbusResponse(baiUnknown16);
+        return true;
+    }
+
+    static constexpr EbusCommand<EbusDeviceBoiler> commands[] = {
+        { 0xb504, 1, EBUS_COMMAND_ANY, &EbusDeviceBoiler::Read },
+        { 0xb505, EBUS_COMMAND_ANY_LEN, EBUS_COMMAND_ANY, &EbusDeviceBoiler::WriteDhw },
+        { 0xb510, 9, 0, &EbusDeviceBoiler::SetMode },
+        { 0xb511, 1, EBUS_COMMAND_ANY, &EbusDeviceBoiler::ReadStatus },
+        { 0xb512, 2, 0, &EbusDeviceBoiler::SetCirculation },
+        { 0xb512, 2, 4, &EbusDeviceBoiler::SetUnknown4 },
+        { 0xb516, EBUS_COMMAND_ANY_LEN, 0x11, &EbusDeviceBoiler::ReadUnknown16 },
+    };
+    static constexpr auto dispatch = EbusMakeCommandTable(commands);
+
+public:
+    bool ProcessSlaveMessage(EbusMessage const &msg, EbusResponse &response)
+    {
+        bool handled;
+        if (dispatch.Dispatch(this, msg, response, handled))
+            return handled;
         return EbusDeviceBase::ProcessSlaveMessage(msg, response);
     }
 
@@ -253,13 +244,16 @@ public:
     {
         printf("BAI id:%02x\r\n", masterAddress);
         printf("Mode hc:%d hwc:%d\r\n", (int)hcMode, (int)hwcMode);
-        printf("Desired temp:%.2f hwc:%.2f stg:%.2f\r\n", tempDesired, hwcDesired, stgDesired);
+        printf("Desired temp:%.2f hwc:%.2f stg:%.2f\r\n", tempDesired.ToFloat(), hwcDesired.ToFloat(), stgDesired.ToFloat());
         printf("Flags disable:%02x\r\n", (int)disableFlags);
     }
 
     int SetSensorsCmd(int argc, char**argv);
 };
 
+constexpr EbusCommand<EbusDeviceBoiler> EbusDeviceBoiler::commands[];
+constexpr decltype(EbusDeviceBoiler::dispatch) EbusDeviceBoiler::dispatch;
+
 EbusDeviceBoiler *bai[8] = {nullptr};
 
 EbusDevice *CreateBAI(EbusBus *bus, uint8_t index)
@@ -332,8 +326,9 @@ int EbusDeviceBoiler::SetSensorsCmd(int argc, char**argv)
     int nerrors = arg_parse(argc, argv, (void **) &bai_set_args);
 
     if ( bai_set_args.outside->count) {
-        outsideTemp = bai_set_args.outside->dval[0];
+        outsideTemp = EbusFixed::FromFloat(bai_set_args.outside->dval[0]);
     }
+    RefreshTemplates();
     return 0;
 }
 
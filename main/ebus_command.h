@@ -0,0 +1,142 @@
+#pragma once
+
+#include <stdint.h>
+
+// an entry taking any first payload byte, or any request length
+#define EBUS_COMMAND_ANY 0x100
+#define EBUS_COMMAND_ANY_LEN 0x1f
+
+// Request handler of Device for a PBSB, request length and first payload
+// byte. Exact entries win over any first byte, then any length for the
+// first byte, then any request at all.
+template<typename Device>
+struct EbusCommand
+{
+    uint16_t cmd;
+    uint8_t len;
+    uint16_t first;
+    bool (Device::*handler)(EbusMessage const &msg, EbusResponse &response);
+
+    static constexpr uint32_t MakeKey(uint16_t cmd, uint8_t len, uint16_t first)
+    {
+        return (uint32_t)cmd << 16 | (uint32_t)len << 9 | first;
+    }
+    constexpr uint32_t Key() const { return MakeKey(cmd, len, first); }
+};
+
+// Perfect hash over the keys of a command list, worked out by the compiler:
+// multiplicative hashing into a power of two of at least twice the entries,
+// trying multipliers until no two keys share a slot. C++11 constexpr is a
+// single return, hence the recursion.
+struct EbusCommandHash
+{
+    static const int SEEDS = 64;
+    static const uint8_t EMPTY = 0xff;
+
+    static constexpr uint32_t Slot(uint32_t key, uint32_t seed, int bits)
+    {
+        return (key * seed) >> (32 - bits);
+    }
+
+    static constexpr int Bits(int count, int bits = 1)
+    {
+        return (1 << bits) >= 2 * count ? bits : Bits(count, bits + 1);
+    }
+
+    static constexpr uint32_t Seed(int n)
+    {
+        // odd multipliers only
+        return 0x9e3779b1u + (uint32_t)n * 0x7f4a7c16u;
+    }
+
+    template<typename Entry>
+    static constexpr bool ClashWith(const Entry *e, int count, uint32_t seed, int bits, int i, int j)
+    {
+        return j < count && (Slot(e[i].Key(), seed, bits) == Slot(e[j].Key(), seed, bits) ||
+            ClashWith(e, count, seed, bits, i, j + 1));
+    }
+
+    template<typename Entry>
+    static constexpr bool Clash(const Entry *e, int count, uint32_t seed, int bits, int i = 0)
+    {
+        return i < count && (ClashWith(e, count, seed, bits, i, i + 1) || Clash(e, count, seed, bits, i + 1));
+    }
+
+    // not constexpr, so running out of seeds stops the build
+    static uint32_t NoPerfectHash();
+
+    template<typename Entry>
+    static constexpr uint32_t FindSeed(const Entry *e, int count, int bits, int n = 0)
+    {
+        return n == SEEDS ? NoPerfectHash() :
+            !Clash(e, count, Seed(n), bits) ? Seed(n) : FindSeed(e, count, bits, n + 1);
+    }
+
+    template<typename Entry>
+    static constexpr uint8_t SlotEntry(const Entry *e, int count, uint32_t seed, int bits, uint32_t slot, int i = 0)
+    {
+        return i == count ? EMPTY :
+            Slot(e[i].Key(), seed, bits) == slot ? i : SlotEntry(e, count, seed, bits, slot, i + 1);
+    }
+};
+
+// Lookup table for a device's commands, a constant built by
+// EbusMakeCommandTable, so it lives in flash. Four probes at most
+// whatever the number of commands.
+template<typename Device, int Bits>
+struct EbusCommandTable
+{
+    const EbusCommand<Device> *commands;
+    uint32_t seed;
+    uint8_t slots[1 << Bits];
+
+    EbusCommand<Device> const *Probe(uint16_t cmd, uint8_t len, uint16_t first) const
+    {
+        auto key = EbusCommand<Device>::MakeKey(cmd, len, first);
+        auto i = slots[EbusCommandHash::Slot(key, seed, Bits)];
+        return i != EbusCommandHash::EMPTY && commands[i].Key() == key ? &commands[i] : nullptr;
+    }
+
+    EbusCommand<Device> const *Find(EbusMessage const &msg) const
+    {
+        auto cmd = msg.GetCmd();
+        auto len = msg.GetPayloadLength();
+        uint16_t first = len ? msg.GetPayload()[0] : EBUS_COMMAND_ANY;
+        auto entry = Probe(cmd, len, first);
+        if (!entry && first != EBUS_COMMAND_ANY)
+            entry = Probe(cmd, len, EBUS_COMMAND_ANY);
+        if (!entry && first != EBUS_COMMAND_ANY)
+            entry = Probe(cmd, EBUS_COMMAND_ANY_LEN, first);
+        if (!entry)
+            entry = Probe(cmd, EBUS_COMMAND_ANY_LEN, EBUS_COMMAND_ANY);
+        return entry;
+    }
+
+    // false when there is no entry, handled tells what it returned
+    bool Dispatch(Device *device, EbusMessage const &msg, EbusResponse &response, bool &handled) const
+    {
+        auto entry = Find(msg);
+        if (!entry)
+            return false;
+        handled = (device->*entry->handler)(msg, response);
+        return true;
+    }
+};
+
+template<typename Device, int Count, int... Slots>
+constexpr EbusCommandTable<Device, EbusCommandHash::Bits(Count)> EbusMakeCommandTable(
+    const EbusCommand<Device> (&commands)[Count], uint32_t seed, EbusIndices<Slots...>)
+{
+    return { commands, seed, { EbusCommandHash::SlotEntry(commands, Count, seed, EbusCommandHash::Bits(Count), Slots)... } };
+}
+
+//   static constexpr EbusCommand<Dev> commands[] = { { 0xb511, 1, EBUS_COMMAND_ANY, &Dev::ReadStatus }, ... };
+//   static constexpr auto dispatch = EbusMakeCommandTable(commands);
+// and, for C++11, both defined once more outside the class.
+template<typename Device, int Count>
+constexpr EbusCommandTable<Device, EbusCommandHash::Bits(Count)> EbusMakeCommandTable(
+    const EbusCommand<Device> (&commands)[Count])
+{
+    return EbusMakeCommandTable(commands, EbusCommandHash::FindSeed(commands, Count, EbusCommandHash::Bits(Count)),
+        typename EbusMakeIndices<1 << EbusCommandHash::Bits(Count)>::type());
+}
@@ -1,6 +1,8 @@
 #include "stdint.h"
 #include "stdio.h"
 
+#include "freertos/FreeRTOS.h"
+
 #include "ebus.h"
 
 #include <vector>
@@ -8,8 +10,44 @@
 #include <cstring>
 
 #include "ebus_dev.h"
+#include "ebus_trace.h"
 
 #include "esp_log.h"
+#include "esp_timer.h"
+
+static EbusStaticPool<EbusMessage, EBUS_MESSAGE_POOL_SIZE> messagePool;
+
+template<> EbusPool<EbusMessage> &EbusPoolOf<EbusMessage>() { return messagePool; }
+
+static EbusStaticPool<EbusTransaction, EBUS_TRANSACTION_POOL_SIZE> transactionPool;
+
+template<> EbusPool<EbusTransaction> &EbusPoolOf<EbusTransaction>() { return transactionPool; }
+
+void EbusTransaction::Complete(EbusTxOutcome result, EbusResponse const *resp)
+{
+    outcome = result;
+    doneAt = esp_timer_get_time();
+    if (callback) {
+        response = resp;
+        callback(*this, ctx);
+        response = nullptr;
+    }
+}
+
+const char *EbusTxOutcomeName(EbusTxOutcome outcome)
+{
+    switch (outcome) {
+        case EbusTxOutcome::Pending: return "pending";
+        case EbusTxOutcome::Success: return "ok";
+        case EbusTxOutcome::Nak: return "nak";
+        case EbusTxOutcome::NoAck: return "no ack";
+        case EbusTxOutcome::LostArbitration: return "lost arb";
+        case EbusTxOutcome::Timeout: return "timeout";
+        case EbusTxOutcome::CrcError: return "crc error";
+        case EbusTxOutcome::Collision: return "collision";
+    }
+    return "?";
+}
 
 EbusMessage::EbusMessage(uint8_t src, uint8_t dst, uint16_t cmd)
 {
@@ -29,6 +67,7 @@ int EbusMessage::GetMessageLength()
 {
     int len = EBUS_HEADER_SIZE + buffer[4];
     buffer[len] = crc8v(buffer, len);
+    crcState = EbusCrcState::Valid;
     return len + EBUS_CRC_SIZE;
 }
 
@@ -49,6 +88,7 @@ bool EbusMessageWriter::Write(uint8_t c)
 {
     if ( len < 5 ) {
         buffer[len++] = c;
+        crc = crc8v_update(crc, c);
         return false;
     }
     int l = buffer[4];
@@ -57,8 +97,13 @@ bool EbusMessageWriter::Write(uint8_t c)
     if (len >= (6+l))
         return true; // overflow
     buffer[len++] = c;
-    if (len == (6+l))
+    if (len == (6+l)) {
+        // c is the CRC byte
+        bool valid = c == crc && buffer[4] <= EBUS_MAX_PAYLOAD;
+        crcState = valid ? EbusCrcState::Valid : EbusCrcState::Invalid;
         return true; // end
+    }
+    crc = crc8v_update(crc, c);
 
     return false;
 }
@@ -71,13 +116,17 @@ EbusResponse::EbusResponse(uint8_t const *buf)
 EbusMessage::EbusMessage(EbusMessage const &msg)
     : EbusBuffer( msg.buffer )
 {
+    crcState = msg.crcState;
+    frame = msg.frame;
 }
 
 
 bool EbusResponseWriter::Write(uint8_t c)
 {
     if ( len < 1 ) {
+        filled = true;
         buffer[len++] = c;
+        crc = crc8v_update(crc, c);
         return false;
     }
     int l = buffer[0];
@@ -86,8 +135,13 @@ bool EbusResponseWriter::Write(uint8_t c)
     if (len >= (2+l))
         return true; // overflow
     buffer[len++] = c;
-    if (len == (2+l))
+    if (len == (2+l)) {
+        // c is the CRC byte
+        bool valid = c == crc && buffer[0] <= EBUS_MAX_PAYLOAD;
+        crcState = valid ? EbusCrcState::Valid : EbusCrcState::Invalid;
         return true; // end
+    }
+    crc = crc8v_update(crc, c);
 
     return false;
 }
@@ -109,6 +163,60 @@ EbusDevice::EbusDevice(uint8_t addr, const char*n)
 {
     slaveAddress = addr;
     name = n;
+    memset(templates, 0, sizeof(templates));
+}
+
+void EbusDevice::PublishTemplate(uint16_t cmd, uint8_t reqLen, uint16_t reqFirst, EbusResponse const &response)
+{
+    if (response.GetFrame()) {
+        PublishTemplate(cmd, reqLen, reqFirst, *response.GetFrame());
+        return;
+    }
+
+    EbusWire wire;
+    wire.PutRaw(ACK);
+    wire.Encode(response);
+
+    EbusResponseTemplate tmpl;
+    tmpl.cmd = cmd;
+    tmpl.reqLen = reqLen;
+    tmpl.reqFirst = reqFirst;
+    tmpl.len = wire.GetLength();
+    memcpy(tmpl.wire, wire.GetData(), tmpl.len);
+    tmpl.constWire = nullptr;
+    StoreTemplate(tmpl);
+}
+
+void EbusDevice::PublishTemplate(uint16_t cmd, uint8_t reqLen, uint16_t reqFirst, EbusConstFrame const &frame)
+{
+    EbusResponseTemplate tmpl;
+    tmpl.cmd = cmd;
+    tmpl.reqLen = reqLen;
+    tmpl.reqFirst = reqFirst;
+    tmpl.len = frame.len;
+    tmpl.constWire = frame.wire;
+    StoreTemplate(tmpl);
+}
+
+void EbusDevice::StoreTemplate(EbusResponseTemplate const &tmpl)
+{
+    EbusResponseTemplate *slot = nullptr;
+    // the receive interrupt may be reading it
+    portENTER_CRITICAL();
+    for (auto &entry : templates) {
+        if (entry.len && entry.cmd == tmpl.cmd && entry.reqLen == tmpl.reqLen && entry.reqFirst == tmpl.reqFirst) {
+            slot = &entry;
+            break;
+        }
+        if (!entry.len && !slot)
+            slot = &entry;
+    }
+    if (slot)
+        *slot = tmpl;
+    portEXIT_CRITICAL();
+
+    if (!slot)
+        ESP_LOGW(name, "No room for template %04x", tmpl.cmd);
 }
 
 template<std::size_t N, std::size_t M>
@@ -137,12 +245,53 @@ bool EbusDevice::ProcessResponse(EbusMessage const &msg, EbusResponse const &res
     return false;
 }
 
+#define S EBUS_ADDR_SLAVE
+#define M EBUS_ADDR_MASTER
+#define B EBUS_ADDR_BROADCAST
+#define I EBUS_ADDR_INVALID
+
+// masters have both nibbles in 0 1 3 7 f
+const uint8_t EBUS_ADDR_CLASS[256] = {
+  M, M, S, M, S, S, S, M, S, S, S, S, S, S, S, M,
+  M, M, S, M, S, S, S, M, S, S, S, S, S, S, S, M,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  M, M, S, M, S, S, S, M, S, S, S, S, S, S, S, M,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  M, M, S, M, S, S, S, M, S, S, S, S, S, S, S, M,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, I, I, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  S, S, S, S, S, S, S, S, S, S, S, S, S, S, S, S,
+  M, M, S, M, S, S, S, M, S, S, S, S, S, S, B, M,
+};
+
+#undef S
+#undef M
+#undef B
+#undef I
+
+bool IS_MASTER(uint8_t c)
+{
+    return EBUS_ADDR_CLASS[c] == EBUS_ADDR_MASTER;
+}
+
 const char*EbusBus::TAG = "EBUS";
 
+EbusBus::EbusBus()
+{
+    memset(deviceMap, 0, sizeof(deviceMap));
+}
+
 void EbusBus::AddDevice(EbusDevice *dev)
 {
     ESP_LOGI("EBUS", "Added device %02x %s", dev->GetSlaveAddress(), dev->GetName());
     devices.push_back(dev);
+    RebuildDeviceMap();
 }
 
 void EbusBus::RemoveDevice(EbusDevice *dev)
@@ -150,17 +299,37 @@ void EbusBus::RemoveDevice(EbusDevice *dev)
     auto pos = std::find(devices.begin(), devices.end(), dev);
     if(pos != devices.end())
         devices.erase(pos);
+    RebuildDeviceMap();
+}
+
+void EbusBus::RebuildDeviceMap()
+{
+    memset(deviceMap, 0, sizeof(deviceMap));
+    for(auto device : devices) {
+        uint8_t addr = device->GetSlaveAddress();
+        deviceMap[addr] = device;
+        // the master of a slave address is 5 below it
+        uint8_t master = addr - 5;
+        if (IS_MASTER(master))
+            deviceMap[master] = device;
+    }
 }
 
 EbusDevice *EbusBus::GetDevice(uint8_t dev)
 {
-    for(auto pos = devices.begin(); pos != devices.end(); pos++ ) {
-        auto device = *pos;
-        if ( device->GetSlaveAddress() == dev) {
-            return device;
-        }
+    return deviceMap[dev];
+}
+
+void EbusBus::QueueMessage(EbusMessagePtr msg, EbusTxClass cls)
+{
+    if (!msg)
+        return;
+    auto tx = EbusTransactionPtr::Create(std::move(msg));
+    if (!tx) {
+        ESP_LOGW(TAG, "no free transaction");
+        return;
     }
-    return nullptr;
+    QueueTransaction(std::move(tx), cls);
 }
 
 void EbusBus::ProcessMessage(EbusMessage const &msg)
@@ -174,43 +343,45 @@ void EbusBus::ProcessMessage(EbusMessage const &msg)
 void EbusBus::ProcessDeviceMessage(EbusMessage const &msg)
 {
     auto dst = msg.GetDest();
-    if (IS_MASTER(dst))
-        dst += 5; // get slave address for target
-    ESP_LOGV(TAG, "Looking for %02x", dst);
-    auto device = GetDevice(dst);
+    auto device = deviceMap[dst];
     if (device) {
-        ESP_LOGV(TAG, "Found dev %s", device->GetName());
+        ESP_LOGV(TAG, "Found dev %s for %02x", device->GetName(), dst);
         bool success = false;
-        EbusResponse *response = nullptr;
-
+        // filled in place by the device, master-master frames and devices
+        // that wrote nothing only get the ACK
+        EbusResponse response;
+
+        EbusTrace(EbusTraceEvent::Dispatch, dst);
+        if (msg.IsValidCRC() && dst == device->GetSlaveAddress()) {
+            auto payload = msg.GetPayloadLength() ? msg.GetPayload()[0] : 0;
+            auto tmpl = device->FindTemplate(msg.GetCmd(), msg.GetPayloadLength(), payload);
+            if (tmpl && SendTemplate(*tmpl)) {
+                EbusTrace(EbusTraceEvent::DispatchDone, dst, true);
+                return;
+            }
+        }
         if ( msg.IsValidCRC() ) {
-            success = device->ProcessSlaveMessage(msg, &response);
+            success = device->ProcessSlaveMessage(msg, response);
         } else {
             ESP_LOGE(TAG, "Bad CRC");
         }
+        EbusTrace(EbusTraceEvent::DispatchDone, dst, success);
 
         if (success) {
             SendACK();
-            if (response) {
-                response->SetCRC();
-                SendResponse(*response);
-            }
+            // the CRC is added while it is encoded
+            if (EBUS_ADDR_CLASS[dst] != EBUS_ADDR_MASTER && response.IsFilled())
+                SendResponse(response);
         } else {
             SendNAK();
         }
-        if ( response )
-            delete response;
     }
 }
 
-bool EbusBus::ProcessSlaveMessage(EbusMessage const &msg, EbusResponse **response)
+bool EbusBus::ProcessSlaveMessage(EbusMessage const &msg, EbusResponse &response)
 {
     bool success = false;
-    auto dst = msg.GetDest();
-    if (IS_MASTER(dst))
-        dst += 5; // get slave address for target
-    ESP_LOGV(TAG, "Looking for %02x", dst);
-    auto device = GetDevice(dst);
+    auto device = deviceMap[msg.GetDest()];
     if (device) {
         ESP_LOGV(TAG, "Found dev %s", device->GetName());
 
@@ -232,10 +403,7 @@ void EbusBus::ProcessBroadcastMessage(EbusMessage const &msg)
 
 void EbusBus::ProcessResponse(EbusMessage const &msg, EbusResponse const &response)
 {
-    auto dst = msg.GetSource();
-    if (IS_MASTER(dst))
-        dst += 5; // get slave address for target
-    auto device = GetDevice(dst);
+    auto device = deviceMap[msg.GetSource()];
     if (device) {
         auto success = false;
         
@@ -257,16 +425,58 @@ void EbusBusData::SendChar(uint8_t c)
 
 void EbusBusData::SendACK()
 {
-    SendChar(ACK);
+    responseWire.Reset();
+    responseWire.PutRaw(ACK);
+    SendWire(responseWire);
 }
 
 void EbusBusData::SendNAK()
 {
-    SendChar(NAK);
+    responseWire.Reset();
+    responseWire.PutRaw(NAK);
+    SendWire(responseWire);
+}
+
+void EbusBusData::SendWire(EbusWire &wire)
+{
+    int count;
+    auto data = wire.TakeUnsent(count);
+    if (count)
+        SendData(data, count);
 }
 
+// a response always follows our ACK, both are echo checked as one
 void EbusBusData::SendResponse(EbusResponse const &response)
 {
-    SendData(response.GetBuffer(), response.GetBufferLength() );
+    if (response.GetFrame())
+        responseWire.Point(*response.GetFrame());
+    else
+        responseWire.Encode(response);
+    SendWire(responseWire);
+}
+
+// a template that is not constant is copied, the device may publish it
+// again while it goes out
+void EbusBusData::LoadTemplate(EbusResponseTemplate const &tmpl)
+{
+    responseWire.Reset();
+    if (tmpl.constWire)
+        responseWire.Point(tmpl.constWire, tmpl.len);
+    else
+        responseWire.PutRaw(tmpl.wire, tmpl.len);
+}
+
+void EbusBusData::RepeatResponse()
+{
+    responseWire.Rewind(1);
+    SendWire(responseWire);
+}
+
+// echo checked like any response, a collision stops it
+bool EbusBusData::SendTemplate(EbusResponseTemplate const &tmpl)
+{
+    LoadTemplate(tmpl);
+    SendWire(responseWire);
+    return true;
 }
 
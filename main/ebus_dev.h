@@ -1,7 +1,12 @@
 #include <math.h>
+#include <string.h>
 #include <vector>
 #include <limits>
 
+#include "ebus_pool.h"
+#include "ebus_value.h"
+#include "ebus_frame.h"
+
 class Ebus
 {
 public:
@@ -10,42 +15,82 @@ public:
     static const int16_t SWORD_REPLACEMENT = 0x8000;
 };
 
+// result of the last CRC check, so a validated frame is not scanned again
+enum class EbusCrcState : uint8_t { Unknown, Valid, Invalid };
+
 template<std::size_t N, std::size_t M>
 class EbusBuffer
 {
 protected:
     uint8_t buffer[N];
+    EbusCrcState crcState = EbusCrcState::Unknown;
+    // the constant this was filled from, until it is changed
+    const EbusConstFrame *frame = nullptr;
+    // anything was written, even an empty payload
+    bool filled = false;
+
     EbusBuffer(const uint8_t *buf)
     {
+        filled = true;
         int len = M+buf[M]+2;
         if (len>N) len = N;
         memcpy(buffer, buf, len);
     }
 
     EbusBuffer() {buffer[M] = 0;}
+
+    EbusBuffer(EbusConstFrame const &f)
+    {
+        int len = f.rawLen;
+        if (len > (int)N) len = N;
+        memcpy(buffer, f.raw, len);
+        crcState = EbusCrcState::Valid;
+        frame = &f;
+        filled = true;
+    }
+
+    void Put(uint8_t c)
+    {
+        crcState = EbusCrcState::Unknown;
+        frame = nullptr;
+        filled = true;
+        buffer[M+(++buffer[M])] = c;
+    }
 public:
 
     void AddPayload(uint8_t c)
     {
-        buffer[M+(++buffer[M])] = c;
+        Put(c);
+    }
+
+    // len more payload bytes to fill in place, nullptr when they don't fit
+    uint8_t *Reserve(int len)
+    {
+        int at = M + 1 + buffer[M];
+        if (at + len + EBUS_CRC_SIZE > (int)N)
+            return nullptr;
+        crcState = EbusCrcState::Unknown;
+        frame = nullptr;
+        filled = true;
+        buffer[M] += len;
+        return &buffer[at];
     }
 
     void AddPayloadBCD(uint8_t c)
     {
-        c = ((c/10)<<4) | (c%10);
-        buffer[M+(++buffer[M])] = c;
+        Put(EbusToBCD(c));
     }
 
     void AddPayload(const char *c, int len)
     {
         while(len--)
-            buffer[M+(++buffer[M])] = *c++;
+            Put(*c++);
     }
 
     void AddPayloadWord(uint16_t d)
     {
-        buffer[M+(++buffer[M])] = d & 0xff;
-        buffer[M+(++buffer[M])] = d>>8;
+        Put(d & 0xff);
+        Put(d>>8);
     }
 
     void AddPayloadSWord(int16_t d)
@@ -55,53 +100,48 @@ public:
 
     void AddPayloadVersion(uint16_t d)
     {
-        buffer[M+(++buffer[M])] = d>>8;
-        buffer[M+(++buffer[M])] = d & 0xff;
+        Put(d>>8);
+        Put(d & 0xff);
     }
 
-    void AddPayloadData1c(float f)
+    void AddPayloadData1c(EbusFixed v)
     {
-        buffer[M+(++buffer[M])] = (int)(f*2);
+        Put(v.IsValid() ? (uint8_t)v.Halves() : Ebus::BYTE_REPLACEMENT);
     }
 
-    void AddPayloadData2b(float f)
+    void AddPayloadData2b(EbusFixed v)
     {
-        int d = (int)(f*256);
-        AddPayloadWord((uint16_t)d);
+        AddPayloadSWord(v.IsValid() ? (int16_t)v.Raw() : Ebus::SWORD_REPLACEMENT);
     }
 
-    void AddPayloadData2c(float f)
+    void AddPayloadData2c(EbusFixed v)
     {
-        int d = (int)(f*16);
-        AddPayloadWord((uint16_t)d);
+        AddPayloadSWord(v.IsValid() ? (int16_t)v.Sixteenths() : Ebus::SWORD_REPLACEMENT);
     }
 
     void AddPayloadDWord(uint32_t d)
     {
-        buffer[M+(++buffer[M])] = d & 0xff;
+        Put(d & 0xff);
         d >>= 8;
-        buffer[M+(++buffer[M])] = d & 0xff;
+        Put(d & 0xff);
         d >>= 8;
-        buffer[M+(++buffer[M])] = d & 0xff;
+        Put(d & 0xff);
         d >>= 8;
-        buffer[M+(++buffer[M])] = d & 0xff;
+        Put(d & 0xff);
         d >>= 8;
     }
 
-    void AddPayloadEXP(float f)
+    void AddPayloadEXP(EbusFixed v)
     {
-        if (std::isnan(f))
-            AddPayloadDWord(0x7fffffff);
-        else
-            AddPayloadDWord(*(uint32_t*)&f);
+        AddPayloadDWord(v.ToExp());
     }
 
-    float ReadPayloadData1c(uint8_t offset) const
+    EbusFixed ReadPayloadData1c(uint8_t offset) const
     {
         auto ret = buffer[1+M+offset];
-        if ( ret == 0xff)
-            return std::numeric_limits<float>::quiet_NaN();
-        return ret / 2.0f;
+        if ( ret == Ebus::BYTE_REPLACEMENT)
+            return EbusFixed();
+        return EbusFixed::FromHalves(ret);
     }
 
     int16_t ReadPayloadWord(uint8_t offset) const
@@ -114,33 +154,45 @@ public:
         return (int16_t)ReadPayloadWord(offset);
     }
 
-    float ReadPayloadData2b(uint8_t offset) const
+    EbusFixed ReadPayloadData2b(uint8_t offset) const
+    {
+        int16_t ret = ReadPayloadSWord(offset);
+        if (ret == Ebus::SWORD_REPLACEMENT)
+            return EbusFixed();
+        return EbusFixed::FromRaw(ret);
+    }
+
+    EbusFixed ReadPayloadData2c(uint8_t offset) const
     {
         int16_t ret = ReadPayloadSWord(offset);
-        if (ret == 0x8000)
-            return std::numeric_limits<float>::quiet_NaN();
+        if (ret == Ebus::SWORD_REPLACEMENT)
+            return EbusFixed();
+        return EbusFixed::FromSixteenths(ret);
+    }
 
-        return  ret / 256.0f;
+    uint32_t ReadPayloadDWord(uint8_t offset) const
+    {
+        auto p = &buffer[1+M+offset];
+        return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
     }
 
-    float ReadPayloadData2c(uint8_t offset) const
+    EbusFixed ReadPayloadEXP(uint8_t offset) const
     {
-        int16_t ret = ReadPayloadSWord(offset); 
-        if (ret == 0x8000)
-            return std::numeric_limits<float>::quiet_NaN();
-        return ret / 16.0f;
+        return EbusFixed::FromExp(ReadPayloadDWord(offset));
     }
 
     int ReadPayloadBCD(uint8_t offset) const
     {
-        auto c = buffer[1+M+offset];
-        return 10*(c>>4)+(c&0xf);
+        return EbusFromBCD(buffer[1+M+offset]);
     }
 
     int GetPayloadLength() const { return buffer[M]; }
     const uint8_t *GetPayload() const { return &buffer[M+1]; }
     const uint8_t *GetBuffer() const {return buffer;}
     int GetBufferLength() const { return M + buffer[M] + 2; }
+    // escaped and ready to send, nullptr when it has to be encoded
+    const EbusConstFrame *GetFrame() const { return frame; }
+    bool IsFilled() const { return filled; }
 
     void SetCRC()
     {
@@ -150,10 +202,13 @@ public:
         len++;
         auto crc = crc8v(buffer, len);
         buffer[len] = crc;
+        crcState = EbusCrcState::Valid;
     }
 
     bool IsValidCRC() const
     {
+        if (crcState != EbusCrcState::Unknown)
+            return crcState == EbusCrcState::Valid;
         if (buffer[M] > EBUS_MAX_PAYLOAD)
             return false;
         int len = M + buffer[M];
@@ -172,6 +227,7 @@ public:
     EbusMessage(uint8_t src, uint8_t dst, uint16_t cmd);
     EbusMessage(uint8_t const *buf);
     EbusMessage(EbusMessage const &msg);
+    EbusMessage(EbusConstFrame const &f) : EbusBuffer(f) {}
 
     int GetMessageLength(); // sets CRC
 
@@ -182,12 +238,14 @@ public:
     void print() const;
 };
 
+// the writers fold each byte into a running CRC and check it against the CRC byte
 class EbusMessageWriter : public EbusMessage
 {
     std::size_t len = 0;
+    uint8_t crc = 0;
 public:
     bool Write(uint8_t c);
-    void Reset() { len = 0;}
+    void Reset() { len = 0; crc = 0; crcState = EbusCrcState::Unknown; }
     bool IsEmpty() { return len == 0; }
 };
 
@@ -196,6 +254,7 @@ class EbusResponse : public EbusBuffer<1 + EBUS_MAX_PAYLOAD + EBUS_CRC_SIZE,0>
 public:
     EbusResponse() {}
     EbusResponse(uint8_t const *buf);
+    EbusResponse(EbusConstFrame const &f) : EbusBuffer(f) {}
 
     void print() const;
 };
@@ -203,18 +262,177 @@ public:
 class EbusResponseWriter : public EbusResponse
 {
     std::size_t len = 0;
+    uint8_t crc = 0;
 public:
     bool Write(uint8_t c);
-    void Reset() { len = 0; buffer[0] = 0;}
+    void Reset() { len = 0; crc = 0; buffer[0] = 0; crcState = EbusCrcState::Unknown; filled = false; }
     bool IsEmpty() const { return len == 0; }
     bool IsFull() const {return len == (buffer[0]+2); }
     int GetWrittenLen() const {return len;}
 };
 
+// Frame as it goes to the uart: escaped, with the CRC folded over the
+// escaped bytes as they are written. Built once per frame and sent from
+// here, the echo is checked against the same bytes. More can be appended
+// after a part was sent, the ACK before a response. A constant frame is
+// not copied, the wire points at it.
+class EbusWire
+{
+    uint8_t wire[EBUS_WIRE_SIZE];
+    const uint8_t *constWire = nullptr;
+    uint8_t len = 0;
+    uint8_t crc = 0;
+    uint8_t sent = 0;
+    uint8_t echoed = 0;
+
+    void PutEscaped(uint8_t c)
+    {
+        if (c == ESC || c == SYN) {
+            wire[len++] = ESC;
+            c = c == ESC ? 0 : 1;
+        }
+        wire[len++] = c;
+    }
+
+    const uint8_t *Data() const { return constWire ? constWire : wire; }
+
+public:
+    void Reset() { constWire = nullptr; len = 0; crc = 0; sent = 0; echoed = 0; }
+
+    // the bytes of frame from here on, what went out so far is kept: a
+    // response frame starts with the ACK that was sent already
+    void Point(EbusConstFrame const &frame)
+    {
+        Point(frame.wire, frame.len);
+        crc = frame.crc;
+    }
+
+    // escaped bytes that stay put, a constant template's
+    void Point(const uint8_t *data, int count)
+    {
+        constWire = data;
+        len = count;
+    }
+
+    // outside the CRC, the ACK in front of a response
+    void PutRaw(uint8_t c) { wire[len++] = c; }
+    // escaped already, a template's
+    void PutRaw(const uint8_t *data, int count)
+    {
+        memcpy(wire + len, data, count);
+        len += count;
+    }
+
+    // header and payload, then the CRC over them
+    void Encode(const uint8_t *data, int count)
+    {
+        crc = 0;
+        while (count--) {
+            auto start = len;
+            PutEscaped(*data++);
+            for (auto n = start; n < len; n++)
+                crc = crc8v_fold(crc, wire[n]);
+        }
+        PutEscaped(crc);
+    }
+
+    // the buffer's own CRC byte is not used
+    template<std::size_t N, std::size_t M>
+    void Encode(EbusBuffer<N,M> const &buffer)
+    {
+        int count = buffer.GetBufferLength() - EBUS_CRC_SIZE;
+        if (count > (int)N - EBUS_CRC_SIZE)
+            count = N - EBUS_CRC_SIZE;
+        Encode(buffer.GetBuffer(), count);
+    }
+
+    const uint8_t *GetData() const { return Data(); }
+    int GetLength() const { return len; }
+    uint8_t GetCRC() const { return crc; }
+
+    // send again from the byte at from, the ones before went out separately
+    void Rewind(int from = 0) { sent = echoed = from; }
+
+    // up to max of the bytes not sent yet, marked as sent
+    const uint8_t *TakeUnsent(int &count, int max = EBUS_WIRE_SIZE)
+    {
+        auto start = sent;
+        count = len - sent;
+        if (count > max)
+            count = max;
+        sent += count;
+        return Data() + start;
+    }
+
+    int GetSent() const { return sent; }
+    bool HasUnsent() const { return sent < len; }
+
+    bool EchoDone() const { return echoed >= sent; }
+    uint8_t Expected() const { return Data()[echoed]; }
+    // false when the bus had something else than we sent
+    bool Echo(uint8_t c) { return Data()[echoed++] == c; }
+};
+
+#define EBUS_MESSAGE_POOL_SIZE 16
+
+template<> EbusPool<EbusMessage> &EbusPoolOf<EbusMessage>();
+
+typedef EbusPtr<EbusMessage> EbusMessagePtr;
+
+// transmit priority, served in this order
+enum class EbusTxClass : uint8_t { Interactive, Control, Poll, Broadcast };
+#define EBUS_TX_CLASSES 4
+
+// class for frames queued without one, clients and writes have to say so
+inline EbusTxClass EbusTxClassOf(EbusMessage const &msg)
+{
+    if (msg.GetDest() == BROADCAST_ADDR || msg.GetCmd() == 0x0704)
+        return EbusTxClass::Broadcast;
+    return EbusTxClass::Poll;
+}
+
+enum class EbusTxOutcome : uint8_t { Pending, Success, Nak, NoAck, LostArbitration, Timeout, CrcError, Collision };
+#define EBUS_TX_OUTCOMES 8
+
+class EbusTransaction;
+typedef void (*EbusTxCallback)(EbusTransaction const &tx, void *ctx);
+
+// A queued frame and who to tell how it went. The callback runs on the bus
+// task, response is only set (for a slave reply) while it runs.
+class EbusTransaction
+{
+public:
+    EbusMessagePtr msg;
+    EbusTxCallback callback;
+    void *ctx;
+    EbusTxOutcome outcome = EbusTxOutcome::Pending;
+    EbusResponse const *response = nullptr;
+    // esp_timer_get_time() when queued, when arbitration was won and when done
+    int64_t queuedAt = 0;
+    int64_t wonAt = 0;
+    int64_t doneAt = 0;
+
+    EbusTransaction(EbusMessagePtr m, EbusTxCallback cb = nullptr, void *c = nullptr)
+        : msg(std::move(m)), callback(cb), ctx(c) {}
+
+    void Complete(EbusTxOutcome result, EbusResponse const *resp = nullptr);
+};
+
+#define EBUS_TRANSACTION_POOL_SIZE EBUS_MESSAGE_POOL_SIZE
+
+template<> EbusPool<EbusTransaction> &EbusPoolOf<EbusTransaction>();
+
+typedef EbusPtr<EbusTransaction> EbusTransactionPtr;
+
+const char *EbusTxOutcomeName(EbusTxOutcome outcome);
+
+class EbusBusStats;
+
 class EbusSender
 {
 public:
-    virtual void Send(EbusMessage const &msg) = 0;
+    // cb, when given, is called with the outcome from the bus task
+    virtual void Send(EbusMessage const &msg, EbusTxCallback cb = nullptr, void *ctx = nullptr) = 0;
 };
 
 class EbusMonitor
@@ -222,6 +440,26 @@ class EbusMonitor
 public:
     virtual void NotifyBroadcast(EbusMessage const &msg) = 0;
     virtual void Notify(EbusMessage const &msg, EbusResponse const &response) = 0;
+    // on the monitor task each time it wakes, for work of the monitor's own
+    virtual void Poll() {}
+};
+
+#define EBUS_DEVICE_TEMPLATES 8
+// matches any first request payload byte
+#define EBUS_TEMPLATE_ANY 0x100
+
+// A ready answer for a read only command: the ACK and the escaped
+// response with its CRC, sent as is without asking the device.
+struct EbusResponseTemplate
+{
+    uint16_t cmd;
+    uint8_t reqLen;         // request payload length
+    uint16_t reqFirst;      // first request payload byte, or EBUS_TEMPLATE_ANY
+    uint8_t len;            // of wire, 0 when unused
+    uint8_t wire[1 + 2 * (1 + EBUS_MAX_PAYLOAD + EBUS_CRC_SIZE)];
+    const uint8_t *constWire;   // a constant frame's, used instead of wire
+
+    const uint8_t *GetWire() const { return constWire ? constWire : wire; }
 };
 
 class EbusDevice
@@ -229,19 +467,41 @@ class EbusDevice
 protected:
     uint8_t slaveAddress;
     const char *name;
+    // read by the receive path, only changed by PublishTemplate
+    EbusResponseTemplate templates[EBUS_DEVICE_TEMPLATES];
+    // requests no handler took, counted rather than logged
+    uint32_t unknownCommands = 0;
 
     EbusDevice(uint8_t addr, const char*name);
 
+    // answer cmd from response from now on, publish again whenever it changes
+    void PublishTemplate(uint16_t cmd, uint8_t reqLen, uint16_t reqFirst, EbusResponse const &response);
+    // a constant response, pointed at rather than copied
+    void PublishTemplate(uint16_t cmd, uint8_t reqLen, uint16_t reqFirst, EbusConstFrame const &frame);
+    void StoreTemplate(EbusResponseTemplate const &tmpl);
+
     template<std::size_t N, std::size_t M>
     static void WriteID(EbusBuffer<N,M> &buffer, uint8_t manu, const char*name, uint16_t sw, uint16_t hw);
 
 public:
-    virtual bool ProcessSlaveMessage(EbusMessage const &msg, EbusResponse **response) = 0;
+    virtual bool ProcessSlaveMessage(EbusMessage const &msg, EbusResponse &response) = 0;
     virtual void ProcessBroadcastMessage(EbusMessage const &msg);
     virtual bool ProcessResponse(EbusMessage const &msg, EbusResponse const &response);
 
     uint8_t GetSlaveAddress() const { return slaveAddress; }
     const char *GetName() const { return name; }
+    uint32_t GetUnknownCommands() const { return unknownCommands; }
+
+    // inlined so the uart interrupt can use it
+    __attribute__((always_inline)) EbusResponseTemplate const *FindTemplate(uint16_t cmd, uint8_t reqLen, uint8_t reqFirst) const
+    {
+        for (auto &tmpl : templates) {
+            if (tmpl.len && tmpl.cmd == cmd && tmpl.reqLen == reqLen &&
+                (tmpl.reqFirst == EBUS_TEMPLATE_ANY || tmpl.reqFirst == reqFirst))
+                return &tmpl;
+        }
+        return nullptr;
+    }
 
     virtual void print();
     virtual void start() {}
@@ -253,36 +513,64 @@ protected:
     static const char *TAG;
 
     std::vector<EbusDevice*> devices;
+    // slave address, and its master address, to device, rebuilt by Add/RemoveDevice
+    EbusDevice *deviceMap[256];
+
+    void RebuildDeviceMap();
 
     virtual void SendACK() = 0;
     virtual void SendNAK() = 0;
     virtual void SendResponse(EbusResponse const &response) = 0;
+    // ACK and response in one go, false when the bus can't
+    virtual bool SendTemplate(EbusResponseTemplate const &tmpl) { return false; }
 
-    bool ProcessSlaveMessage(EbusMessage const &msg, EbusResponse **response);
+    bool ProcessSlaveMessage(EbusMessage const &msg, EbusResponse &response);
     void ProcessDeviceMessage(EbusMessage const &msg);
     void ProcessBroadcastMessage(EbusMessage const &msg);
     void ProcessMessage(EbusMessage const &msg);
 
     virtual void ProcessResponse(EbusMessage const &msg, EbusResponse const &response);
 public:
+    EbusBus();
+
     void AddDevice(EbusDevice *dev);
     void RemoveDevice(EbusDevice *dev);
     EbusDevice *GetDevice(uint8_t id);
 
-    virtual void QueueMessage(EbusMessage const *msg) =0;
+    // fire and forget
+    void QueueMessage(EbusMessagePtr msg)
+    {
+        if (!msg)
+            return;
+        auto cls = EbusTxClassOf(*msg);
+        QueueMessage(std::move(msg), cls);
+    }
+    void QueueMessage(EbusMessagePtr msg, EbusTxClass cls);
+    // false when it could not be queued, the callback is not called then
+    virtual bool QueueTransaction(EbusTransactionPtr tx, EbusTxClass cls) =0;
+    virtual void PrintStats() {}
+    virtual EbusBusStats *GetStats() { return nullptr; }
 };
 
 class EbusBusData : public EbusBus
 {
+    EbusWire responseWire;
 protected:
     virtual void SendData(const uint8_t*data, int len) = 0;
+    // what wire has not sent yet, the echo gets checked against it
+    virtual void SendWire(EbusWire &wire);
     void SendChar(uint8_t c);
     virtual void SendACK();
     virtual void SendNAK();
     virtual void SendResponse(EbusResponse const &response);
+    bool SendTemplate(EbusResponseTemplate const &tmpl);
+    // ACK and response of tmpl as the ones sent last
+    void LoadTemplate(EbusResponseTemplate const &tmpl);
+    // the last response once more after the master NAKed it, without the ACK
+    void RepeatResponse();
 };
 
 
 
 EbusMonitor *initialise_ebusd(EbusSender *sender);
-EbusMonitor *initialise_mqtt(EbusSender *sender);
+EbusMonitor *initialise_mqtt(EbusSender *sender, EbusBusStats *stats);
@@ -10,26 +10,30 @@
 
 #include "esp_log.h"
 
-bool EbusDeviceBase1::ProcessSlaveMessage(EbusMessage const &msg, EbusResponse **response) 
+// the identification never changes
+void EbusDeviceBase1::PublishId()
 {
-    auto cmd = msg.GetCmd();
-    auto len = msg.GetPayloadLength();
-    switch(cmd)
-    {
-        case 0x0704:
-            if(len==0)
-            {
-                *response = new EbusResponse();
-                WriteID(**response, manu, name, sw, hw);
-                return true;
-            }
-            break;
-        default:
-            ESP_LOGW(name, "Unknown command %04x", cmd);
-            if ((cmd&0xff00)==0xb500) {
-
-            }
-    }
+    EbusResponse response;
+    WriteID(response, manu, name, sw, hw);
+    PublishTemplate(0x0704, 0, EBUS_TEMPLATE_ANY, response);
+}
+
+constexpr EbusCommand<EbusDeviceBase1> EbusDeviceBase1::commands[];
+constexpr decltype(EbusDeviceBase1::dispatch) EbusDeviceBase1::dispatch;
+
+bool EbusDeviceBase1::ReadId(EbusMessage const &msg, EbusResponse &response)
+{
+    WriteID(response, manu, name, sw, hw);
+    return true;
+}
+
+// the last stop for every device, what nobody took is counted
+bool EbusDeviceBase1::ProcessSlaveMessage(EbusMessage const &msg, EbusResponse &response)
+{
+    bool handled;
+    if (dispatch.Dispatch(this, msg, response, handled))
+        return handled;
+    unknownCommands++;
     return false;
 }
 
@@ -38,10 +42,9 @@ bool EbusDeviceBase::ProcessTimer(int cnt)
 {
     if ( (cnt % 60) == 0 ) {
         ESP_LOGI(name,"Sending ID");
-        auto cmd = new EbusMessage(masterAddress, BROADCAST_ADDR, 0x0704);
-        WriteID(*cmd, manu, name, sw, hw);
-        cmd->SetCRC();
-        bus->QueueMessage(cmd);
+        auto cmd = EbusMessagePtr::Create(idFrame);
+        if (cmd)
+            bus->QueueMessage(std::move(cmd));
     }
 
     return true;
@@ -1,7 +1,16 @@
 
 
+#include "ebus_command.h"
+
 class EbusDeviceBase1 : public EbusDevice
 {
+    bool ReadId(EbusMessage const &msg, EbusResponse &response);
+
+    static constexpr EbusCommand<EbusDeviceBase1> commands[] = {
+        { 0x0704, 0, EBUS_COMMAND_ANY, &EbusDeviceBase1::ReadId },
+    };
+    static constexpr auto dispatch = EbusMakeCommandTable(commands);
+
 protected:
     uint8_t manu;
     uint16_t sw,hw;
@@ -11,9 +20,11 @@ protected:
         manu = m;
         sw=s;
         hw=h;
+        PublishId();
     }
 
-    virtual bool ProcessSlaveMessage(EbusMessage const &msg, EbusResponse **response);
+    void PublishId();
+    virtual bool ProcessSlaveMessage(EbusMessage const &msg, EbusResponse &response);
 
 };
 
@@ -23,6 +34,8 @@ protected:
     EbusBus *bus;
     uint8_t masterAddress;
     TimerHandle_t bcastTimer;
+    // the identification broadcast, encoded once
+    const EbusConstFrame idFrame;
 
     virtual bool ProcessTimer(int cnt);
 
@@ -31,7 +44,9 @@ protected:
 
 public:
     EbusDeviceBase(uint8_t addr, uint8_t m, const char *n,uint16_t s, uint16_t h,EbusBus *b)
-        :EbusDeviceBase1(addr+5, m,n,s,h)
+        :EbusDeviceBase1(addr+5, m,n,s,h),
+        idFrame(EbusMakeFrame(addr, BROADCAST_ADDR, 0x0704, m, n[0], n[1], n[2], n[3], n[4],
+            s >> 8, s & 0xff, h >> 8, h & 0xff))
     {
         masterAddress = addr;
         bus = b;
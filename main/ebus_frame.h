@@ -0,0 +1,103 @@
+#pragma once
+
+#include <stdint.h>
+
+// a whole frame escaped, and the ACK in front of a response
+#define EBUS_WIRE_SIZE (1 + 2 * (EBUS_HEADER_SIZE + EBUS_MAX_PAYLOAD + EBUS_CRC_SIZE))
+
+// 0 .. N-1 as a parameter pack, for building arrays in constexpr
+template<int...> struct EbusIndices {};
+template<int N, int... I> struct EbusMakeIndices : EbusMakeIndices<N - 1, N - 1, I...> {};
+template<int... I> struct EbusMakeIndices<0, I...> { typedef EbusIndices<I...> type; };
+
+// A frame that never changes, escaped with its CRC by the compiler. It is
+// sent by pointing the wire at it, and the unescaped bytes fill a message
+// or response for the parser without computing anything.
+struct EbusConstFrame
+{
+    uint8_t raw[EBUS_HEADER_SIZE + EBUS_MAX_PAYLOAD + EBUS_CRC_SIZE];   // as in the buffer, CRC last
+    uint8_t rawLen;
+    uint8_t wire[EBUS_WIRE_SIZE];
+    uint8_t len;
+    uint8_t crc;
+};
+
+// crc8v, escaping and byte lookup over a list of bytes, as C++11 constexpr
+struct EbusFrameCode
+{
+    // a row of the crc8v table, polynom 0x9b
+    static constexpr uint8_t Table(uint8_t x, int bits = 8)
+    {
+        return bits == 0 ? x : Table(x & 0x80 ? (uint8_t)((x << 1) ^ 0x9b) : (uint8_t)(x << 1), bits - 1);
+    }
+
+    static constexpr bool Escaped(uint8_t c) { return c == ESC || c == SYN; }
+
+    static constexpr uint8_t Fold(uint8_t crc, uint8_t c) { return Table(crc) ^ c; }
+
+    // over the escaped bytes, like crc8v
+    static constexpr uint8_t Crc(uint8_t crc) { return crc; }
+    template<typename... T>
+    static constexpr uint8_t Crc(uint8_t crc, uint8_t c, T... rest)
+    {
+        return Crc(Escaped(c) ? Fold(Fold(crc, ESC), c == ESC ? 0 : 1) : Fold(crc, c), rest...);
+    }
+
+    static constexpr int Length() { return 0; }
+    template<typename... T>
+    static constexpr int Length(uint8_t c, T... rest)
+    {
+        return (Escaped(c) ? 2 : 1) + Length(rest...);
+    }
+
+    // byte i of the escaped list, 0 past the end
+    static constexpr uint8_t WireAt(int i) { return 0; }
+    template<typename... T>
+    static constexpr uint8_t WireAt(int i, uint8_t c, T... rest)
+    {
+        return !Escaped(c) ? (i == 0 ? c : WireAt(i - 1, rest...)) :
+            i == 0 ? ESC : i == 1 ? (c == ESC ? 0 : 1) : WireAt(i - 2, rest...);
+    }
+
+    static constexpr uint8_t At(int i) { return 0; }
+    template<typename... T>
+    static constexpr uint8_t At(int i, uint8_t c, T... rest)
+    {
+        return i == 0 ? c : At(i - 1, rest...);
+    }
+};
+
+template<int... W, int... R, typename... T>
+constexpr EbusConstFrame EbusBuildFrame(bool ack, EbusIndices<W...>, EbusIndices<R...>, uint8_t crc, T... bytes)
+{
+    return {
+        { EbusFrameCode::At(R, bytes..., crc)... },
+        (uint8_t)(sizeof...(T) + EBUS_CRC_SIZE),
+        { (uint8_t)(!ack ? EbusFrameCode::WireAt(W, bytes..., crc) : W == 0 ? ACK : EbusFrameCode::WireAt(W - 1, bytes..., crc))... },
+        (uint8_t)(ack + EbusFrameCode::Length(bytes..., crc)),
+        crc,
+    };
+}
+
+// QQ ZZ PB SB NN and the data. A frame from a device's own master address
+// is built once when the device is created, the same way.
+template<typename... T>
+constexpr EbusConstFrame EbusMakeFrame(uint8_t src, uint8_t dst, uint16_t cmd, T... data)
+{
+    static_assert(sizeof...(T) <= EBUS_MAX_PAYLOAD, "payload too long for a frame");
+    return EbusBuildFrame(false, typename EbusMakeIndices<EBUS_WIRE_SIZE>::type(),
+        typename EbusMakeIndices<EBUS_HEADER_SIZE + EBUS_MAX_PAYLOAD + EBUS_CRC_SIZE>::type(),
+        EbusFrameCode::Crc(0, src, dst, cmd >> 8, cmd & 0xff, sizeof...(T), data...),
+        src, dst, (uint8_t)(cmd >> 8), (uint8_t)(cmd & 0xff), (uint8_t)sizeof...(T), data...);
+}
+
+// NN and the data, with the ACK in front that goes out before it
+template<typename... T>
+constexpr EbusConstFrame EbusMakeResponse(T... data)
+{
+    static_assert(sizeof...(T) <= EBUS_MAX_PAYLOAD, "payload too long for a response");
+    return EbusBuildFrame(true, typename EbusMakeIndices<EBUS_WIRE_SIZE>::type(),
+        typename EbusMakeIndices<EBUS_HEADER_SIZE + EBUS_MAX_PAYLOAD + EBUS_CRC_SIZE>::type(),
+        EbusFrameCode::Crc(0, sizeof...(T), data...),
+        (uint8_t)sizeof...(T), data...);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Fixed size latency histogram in microseconds. Buckets are powers of two
+// split in four, so a percentile is at most 25% above the real value.
+// Everything from 2^20us (about a second) up shares the last bucket, the
+// max is kept exactly.
+
+#define EBUS_HIST_SUB_BITS 2
+#define EBUS_HIST_OCTAVES 20
+#define EBUS_HIST_BUCKETS ((EBUS_HIST_OCTAVES - EBUS_HIST_SUB_BITS + 1) << EBUS_HIST_SUB_BITS)
+
+class EbusHistogram
+{
+    uint32_t buckets[EBUS_HIST_BUCKETS];
+    uint32_t count;
+    uint32_t max;
+
+    static int Bucket(uint32_t us)
+    {
+        if (us < (1 << EBUS_HIST_SUB_BITS))
+            return us;
+        if (us >= (1 << EBUS_HIST_OCTAVES))
+            return EBUS_HIST_BUCKETS - 1;
+        int octave = 31 - __builtin_clz(us);
+        int sub = (us >> (octave - EBUS_HIST_SUB_BITS)) & ((1 << EBUS_HIST_SUB_BITS) - 1);
+        return ((octave - EBUS_HIST_SUB_BITS + 1) << EBUS_HIST_SUB_BITS) + sub;
+    }
+
+    // largest value that goes into the bucket
+    static uint32_t BucketTop(int index)
+    {
+        if (index < (1 << EBUS_HIST_SUB_BITS))
+            return index;
+        int shift = (index >> EBUS_HIST_SUB_BITS) - 1;
+        int sub = index & ((1 << EBUS_HIST_SUB_BITS) - 1);
+        return (((1 << EBUS_HIST_SUB_BITS) + sub + 1) << shift) - 1;
+    }
+
+public:
+    EbusHistogram() { Clear(); }
+
+    void Clear()
+    {
+        for (auto &bucket : buckets)
+            bucket = 0;
+        count = 0;
+        max = 0;
+    }
+
+    void Add(int64_t us)
+    {
+        uint32_t value = us < 0 ? 0 : us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+        buckets[Bucket(value)]++;
+        count++;
+        if (value > max)
+            max = value;
+    }
+
+    uint32_t GetCount() const { return count; }
+    uint32_t GetMax() const { return max; }
+
+    // top of the bucket holding the percentile, never above the max
+    uint32_t Percentile(int pct) const
+    {
+        if (!count)
+            return 0;
+        uint32_t rank = ((uint64_t)count * pct + 99) / 100;
+        if (!rank)
+            rank = 1;
+        uint32_t seen = 0;
+        for (int n = 0; n < EBUS_HIST_BUCKETS; n++) {
+            seen += buckets[n];
+            if (seen >= rank) {
+                auto top = n == EBUS_HIST_BUCKETS - 1 ? max : BucketTop(n);
+                return top < max ? top : max;
+            }
+        }
+        return max;
+    }
+
+    void print(const char *name) const
+    {
+        printf("%-10s %8u %8u %8u %8u %8u\r\n", name, count,
+            Percentile(50), Percentile(90), Percentile(99), max);
+    }
+};
@@ -0,0 +1,191 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "ebus.h"
+#include "ebus_dev.h"
+#include "ebus_ring.h"
+#include "ebus_log.h"
+
+#include "esp_log.h"
+
+static EbusMpscRing<EbusLogRecord, EBUS_LOG_RING_SIZE> logRing;
+static uint32_t reportedDrops;
+
+void EbusLogFrame(EbusLogEvent event, const uint8_t *data, int len, uint8_t arg)
+{
+    EbusLogRecord record;
+    record.time = esp_log_timestamp();
+    record.event = event;
+    record.arg = arg;
+    record.arg2 = 0;
+    if (len > EBUS_LOG_DATA)
+        len = EBUS_LOG_DATA;
+    if (len < 0)
+        len = 0;
+    record.len = len;
+    memcpy(record.data, data, len);
+    logRing.Push(record);
+}
+
+void EbusLog(EbusLogEvent event, uint8_t arg, uint8_t arg2)
+{
+    EbusLogRecord record;
+    record.time = esp_log_timestamp();
+    record.event = event;
+    record.arg = arg;
+    record.arg2 = arg2;
+    record.len = 0;
+    logRing.Push(record);
+}
+
+void EbusLogTransaction(EbusTransaction const &tx)
+{
+    uint32_t times[2];
+    times[0] = tx.wonAt ? tx.wonAt - tx.queuedAt : tx.doneAt - tx.queuedAt;
+    times[1] = tx.wonAt ? tx.doneAt - tx.wonAt : 0;
+
+    EbusLogRecord record;
+    record.time = esp_log_timestamp();
+    record.event = EbusLogEvent::TxDone;
+    record.arg = (uint8_t)tx.outcome;
+    record.arg2 = tx.wonAt != 0;
+    record.len = sizeof(times);
+    memcpy(record.data, times, sizeof(times));
+    logRing.Push(record);
+
+    if (tx.response)
+        EbusLogFrame(EbusLogEvent::TxResponse, tx.response->GetBuffer(), tx.response->GetBufferLength());
+}
+
+static void PrintRecord(EbusLogRecord &record)
+{
+    // frames are printed by the message classes, pad what wasn't captured
+    memset(record.data + record.len, 0, EBUS_LOG_DATA - record.len);
+
+    printf("(%u) ", record.time);
+    switch (record.event) {
+        case EbusLogEvent::Request:
+            printf("r:");
+            EbusMessage(record.data).print();
+            break;
+        case EbusLogEvent::Broadcast:
+            printf("B:");
+            EbusMessage(record.data).print();
+            break;
+        case EbusLogEvent::BadRequest:
+            printf("X:");
+            EbusMessage(record.data).print();
+            break;
+        case EbusLogEvent::Response:
+            printf("  c:");
+            EbusResponse(record.data).print();
+            break;
+        case EbusLogEvent::Incomplete:
+            printf("e: ");
+            EbusMessage(record.data).print();
+            break;
+        case EbusLogEvent::NoSlaveAck:
+            printf("No Slave Ack\r\n");
+            break;
+        case EbusLogEvent::FailedResponse:
+            printf("Failed response len=%d\r\n", record.arg);
+            if (record.arg > 0)
+                EbusResponse(record.data).print();
+            break;
+        case EbusLogEvent::NoMasterAck:
+            printf("No Master Ack\r\n");
+            break;
+        case EbusLogEvent::ArbitrationLost:
+            printf("Failed arb %02x %02x\r\n", record.arg, record.arg2);
+            break;
+        case EbusLogEvent::NakRepeat:
+            printf("NAKed, repeat\r\n");
+            break;
+        case EbusLogEvent::ResponseNakRepeat:
+            printf("response NAKed, repeat\r\n");
+            break;
+        case EbusLogEvent::Nak:
+            printf("NAKed\r\n");
+            break;
+        case EbusLogEvent::NotAck:
+            printf("not ack %02x\r\n", record.arg);
+            break;
+        case EbusLogEvent::BadResponse:
+            printf("resp bad\r\n");
+            break;
+        case EbusLogEvent::ResponseNotAck:
+            printf("Not ack for response %02x\r\n", record.arg);
+            break;
+        case EbusLogEvent::Unexpected:
+            printf("unexpected data %02x\r\n", record.arg);
+            break;
+        case EbusLogEvent::Timeout:
+            printf("timeout in state %d\r\n", record.arg);
+            break;
+        case EbusLogEvent::BecameSynMaster:
+            printf("becoming SYN\r\n");
+            break;
+        case EbusLogEvent::OtherSyn:
+            printf("received other SYN\r\n");
+            break;
+        case EbusLogEvent::Collision:
+            printf("collision %02x sent %02x\r\n", record.arg, record.arg2);
+            break;
+        case EbusLogEvent::TxDone:
+        {
+            uint32_t times[2];
+            memcpy(times, record.data, sizeof(times));
+            printf("tx %s queued %dus", EbusTxOutcomeName((EbusTxOutcome)record.arg), (int)times[0]);
+            if (record.arg2)
+                printf(" on bus %dus", (int)times[1]);
+            printf("\r\n");
+            break;
+        }
+        case EbusLogEvent::TxResponse:
+            EbusResponse(record.data).print();
+            break;
+        case EbusLogEvent::ProxyRequest:
+            printf("p:");
+            EbusMessage(record.data).print();
+            break;
+        case EbusLogEvent::ProxyQueued:
+            printf("q:");
+            EbusMessage(record.data).print();
+            break;
+    }
+}
+
+void EbusLogDrain()
+{
+    EbusLogRecord record;
+    while (logRing.Pop(record))
+        PrintRecord(record);
+
+    auto dropped = logRing.GetPushFailed();
+    if (dropped != reportedDrops) {
+        printf("log: %u records dropped\r\n", dropped - reportedDrops);
+        reportedDrops = dropped;
+    }
+}
+
+uint32_t EbusLogDropped()
+{
+    return logRing.GetPushFailed();
+}
+
+static void LogTaskCallback(void *args)
+{
+    while (true) {
+        EbusLogDrain();
+        vTaskDelay(20 / portTICK_PERIOD_MS);
+    }
+}
+
+void EbusLogStart()
+{
+    xTaskCreate(LogTaskCallback, "ebus_log", 2048, nullptr, tskIDLE_PRIORITY, nullptr);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "ebus.h"
+
+class EbusTransaction;
+
+// what the bus task saw, formatted later by the log task
+enum class EbusLogEvent : uint8_t {
+    Request,            // r: frame
+    Broadcast,          // B: frame
+    BadRequest,         // X: frame
+    Response,           // c: frame
+    Incomplete,         // e: frame cut short by SYN
+    NoSlaveAck,
+    FailedResponse,     // arg = bytes received, frame
+    NoMasterAck,
+    ArbitrationLost,    // arg = byte seen, arg2 = our source
+    NakRepeat,
+    ResponseNakRepeat,
+    Nak,
+    NotAck,             // arg = byte seen
+    BadResponse,
+    ResponseNotAck,     // arg = byte seen
+    Unexpected,         // arg = byte seen
+    Timeout,            // arg = state
+    BecameSynMaster,
+    OtherSyn,
+    Collision,          // arg = byte seen, arg2 = byte sent
+    TxDone,             // arg = EbusTxOutcome, arg2 = 1 when won, us queued and on the bus
+    TxResponse,         // frame, the response to the TxDone before
+    ProxyRequest,       // p: frame, b517 unwrapped for the bridged devices
+    ProxyQueued,        // q: frame, queued by a bridged device
+};
+
+#define EBUS_LOG_DATA (EBUS_HEADER_SIZE + EBUS_MAX_PAYLOAD + EBUS_CRC_SIZE)
+#define EBUS_LOG_RING_SIZE 16
+
+struct EbusLogRecord
+{
+    uint32_t time;      // esp_log_timestamp()
+    EbusLogEvent event;
+    uint8_t arg;
+    uint8_t arg2;
+    uint8_t len;
+    uint8_t data[EBUS_LOG_DATA];
+};
+
+// Never blocks: a full ring drops the record and counts it.
+void EbusLog(EbusLogEvent event, uint8_t arg = 0, uint8_t arg2 = 0);
+void EbusLogFrame(EbusLogEvent event, const uint8_t *data, int len, uint8_t arg = 0);
+// outcome, times and response of a finished transaction, from its callback
+void EbusLogTransaction(EbusTransaction const &tx);
+
+// format everything queued, the log task does this at idle priority
+void EbusLogDrain();
+void EbusLogStart();
+uint32_t EbusLogDropped();
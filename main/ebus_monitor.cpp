@@ -0,0 +1,114 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "ebus.h"
+#include "ebus_dev.h"
+#include "ebus_monitor.h"
+
+static TaskHandle_t monitorTask;
+static EbusAsyncMonitor *firstMonitor;
+
+static void MonitorTaskCallback(void *args)
+{
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        EbusAsyncMonitor::DrainAll();
+    }
+}
+
+EbusAsyncMonitor::EbusAsyncMonitor(const char *name, EbusMonitor *target, EbusDropPolicy policy)
+    : target(target), name(name), policy(policy)
+{
+    // monitors are only added at start up
+    next = firstMonitor;
+    firstMonitor = this;
+
+    // below the bus task
+    if (!monitorTask)
+        xTaskCreate(MonitorTaskCallback, "ebus_mon", 2048, nullptr, 3, &monitorTask);
+}
+
+void EbusAsyncMonitor::Push(bool broadcast, EbusMessage const &msg, EbusResponse const *response)
+{
+    portENTER_CRITICAL();
+    if (count == EBUS_MONITOR_RING_SIZE) {
+        dropped++;
+        if (policy == EbusDropPolicy::DropNewest) {
+            portEXIT_CRITICAL();
+            return;
+        }
+        head = (head + 1) % EBUS_MONITOR_RING_SIZE;
+        count--;
+    }
+    auto &event = ring[(head + count) % EBUS_MONITOR_RING_SIZE];
+    event.broadcast = broadcast;
+    // NN is as it came off the wire, it may claim more than a frame holds
+    size_t len = msg.GetBufferLength();
+    if (len > sizeof(event.msg))
+        len = sizeof(event.msg);
+    memcpy(event.msg, msg.GetBuffer(), len);
+    if (response)
+        event.response = *response;
+    if (++count > highWater)
+        highWater = count;
+    portEXIT_CRITICAL();
+
+    if (monitorTask)
+        xTaskNotifyGive(monitorTask);
+}
+
+bool EbusAsyncMonitor::Pop(Event &event)
+{
+    portENTER_CRITICAL();
+    bool have = count > 0;
+    if (have) {
+        event = ring[head];
+        head = (head + 1) % EBUS_MONITOR_RING_SIZE;
+        count--;
+    }
+    portEXIT_CRITICAL();
+    return have;
+}
+
+void EbusAsyncMonitor::Drain()
+{
+    Event event;
+    while (Pop(event)) {
+        EbusMessage msg(event.msg);
+        if (event.broadcast)
+            target->NotifyBroadcast(msg);
+        else
+            target->Notify(msg, event.response);
+        delivered++;
+    }
+    target->Poll();
+}
+
+void EbusAsyncMonitor::print()
+{
+    printf("monitor %-6s %s used:%d high:%d delivered:%u dropped:%u\r\n", name,
+        policy == EbusDropPolicy::DropOldest ? "oldest" : "newest",
+        count, highWater, delivered, dropped);
+}
+
+void EbusAsyncMonitor::DrainAll()
+{
+    for (auto mon = firstMonitor; mon; mon = mon->next)
+        mon->Drain();
+}
+
+void EbusAsyncMonitor::Wake()
+{
+    if (monitorTask)
+        xTaskNotifyGive(monitorTask);
+}
+
+void EbusAsyncMonitor::PrintAll()
+{
+    for (auto mon = firstMonitor; mon; mon = mon->next)
+        mon->print();
+}
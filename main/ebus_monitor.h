@@ -0,0 +1,60 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define EBUS_MONITOR_RING_SIZE 8
+
+enum class EbusDropPolicy : uint8_t { DropOldest, DropNewest };
+
+// Hands bus events to a monitor from the monitor task instead of the bus
+// task, so a slow MQTT broker or a stalled ebusd socket can't hold up byte
+// reception. Events wait in a small ring per monitor, when it is full the
+// policy decides whether the oldest or the new event is lost.
+class EbusAsyncMonitor : public EbusMonitor
+{
+    struct Event
+    {
+        bool broadcast;
+        uint8_t msg[EBUS_HEADER_SIZE + EBUS_MAX_PAYLOAD + EBUS_CRC_SIZE];
+        EbusResponse response;
+    };
+
+    EbusMonitor *target;
+    const char *name;
+    EbusDropPolicy policy;
+
+    Event ring[EBUS_MONITOR_RING_SIZE];
+    uint8_t head = 0;
+    uint8_t count = 0;
+    uint8_t highWater = 0;
+    uint32_t delivered = 0;
+    uint32_t dropped = 0;
+
+    EbusAsyncMonitor *next;
+
+    void Push(bool broadcast, EbusMessage const &msg, EbusResponse const *response);
+    bool Pop(Event &event);
+
+public:
+    EbusAsyncMonitor(const char *name, EbusMonitor *target, EbusDropPolicy policy);
+
+    void NotifyBroadcast(EbusMessage const &msg)
+    {
+        Push(true, msg, nullptr);
+    }
+
+    void Notify(EbusMessage const &msg, EbusResponse const &response)
+    {
+        Push(false, msg, &response);
+    }
+
+    // deliver what is queued, monitor task only
+    void Drain();
+    void print();
+
+    static void DrainAll();
+    static void PrintAll();
+    // any task, gets the monitors polled without an event
+    static void Wake();
+};
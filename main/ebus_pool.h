@@ -0,0 +1,144 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <new>
+#include <utility>
+
+#include "freertos/FreeRTOS.h"
+
+struct EbusPoolStats
+{
+    uint16_t size;
+    uint16_t inUse;
+    uint16_t highWater;
+    uint32_t acquired;
+    uint32_t exhausted;
+};
+
+// Fixed block pool, the free list is a stack so acquire/release are O(1).
+// Callers come from the bus task, timers and the console, so the list is
+// updated in a short critical section.
+template<typename T>
+class EbusPool
+{
+protected:
+    union Slot
+    {
+        Slot *next;
+        alignas(T) uint8_t storage[sizeof(T)];
+    };
+
+    Slot *freeList;
+    EbusPoolStats stats;
+
+    EbusPool(Slot *slots, uint16_t count)
+    {
+        freeList = nullptr;
+        for (int n = count - 1; n >= 0; n--) {
+            slots[n].next = freeList;
+            freeList = &slots[n];
+        }
+        stats = {count, 0, 0, 0, 0};
+    }
+
+public:
+    template<typename... Args>
+    T *Acquire(Args&&... args)
+    {
+        portENTER_CRITICAL();
+        Slot *slot = freeList;
+        if (slot) {
+            freeList = slot->next;
+            stats.acquired++;
+            if (++stats.inUse > stats.highWater)
+                stats.highWater = stats.inUse;
+        } else {
+            stats.exhausted++;
+        }
+        portEXIT_CRITICAL();
+
+        if (!slot)
+            return nullptr;
+        return new (slot->storage) T(std::forward<Args>(args)...);
+    }
+
+    void Release(T *obj)
+    {
+        obj->~T();
+        auto slot = reinterpret_cast<Slot*>(obj);
+        portENTER_CRITICAL();
+        slot->next = freeList;
+        freeList = slot;
+        stats.inUse--;
+        portEXIT_CRITICAL();
+    }
+
+    EbusPoolStats GetStats() const { return stats; }
+};
+
+template<typename T, size_t N>
+class EbusStaticPool : public EbusPool<T>
+{
+    typename EbusPool<T>::Slot slots[N];
+public:
+    EbusStaticPool() : EbusPool<T>(slots, N) {}
+};
+
+// each pooled type has one pool, defined next to the type
+template<typename T>
+EbusPool<T> &EbusPoolOf();
+
+// Owning handle for a pooled object, returns it to its pool when dropped.
+// Create() gives an empty handle when the pool is exhausted.
+template<typename T>
+class EbusPtr
+{
+    T *ptr = nullptr;
+
+    explicit EbusPtr(T *p) : ptr(p) {}
+public:
+    EbusPtr() {}
+    EbusPtr(EbusPtr &&other) : ptr(other.ptr) { other.ptr = nullptr; }
+    EbusPtr(EbusPtr const &) = delete;
+    ~EbusPtr() { reset(); }
+
+    EbusPtr &operator=(EbusPtr &&other)
+    {
+        if (this != &other) {
+            reset();
+            ptr = other.ptr;
+            other.ptr = nullptr;
+        }
+        return *this;
+    }
+    EbusPtr &operator=(EbusPtr const &) = delete;
+
+    template<typename... Args>
+    static EbusPtr Create(Args&&... args)
+    {
+        return EbusPtr(EbusPoolOf<T>().Acquire(std::forward<Args>(args)...));
+    }
+
+    // take back ownership of a pointer previously given up by release()
+    static EbusPtr Adopt(T *p) { return EbusPtr(p); }
+
+    void reset()
+    {
+        if (ptr)
+            EbusPoolOf<T>().Release(ptr);
+        ptr = nullptr;
+    }
+
+    T *release()
+    {
+        auto p = ptr;
+        ptr = nullptr;
+        return p;
+    }
+
+    T *get() const { return ptr; }
+    T *operator->() const { return ptr; }
+    T &operator*() const { return *ptr; }
+    explicit operator bool() const { return ptr != nullptr; }
+};
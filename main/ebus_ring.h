@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+// Bounded lock-free multi-producer/single-consumer ring (Vyukov style).
+// Each cell carries a sequence number: producers claim a slot by CAS on
+// head and publish it by bumping the sequence, the single consumer reads
+// in order without any CAS. A full ring fails the push and counts it.
+// T must be trivially copyable, N a power of 2.
+template<typename T, size_t N>
+class EbusMpscRing
+{
+    static_assert((N & (N - 1)) == 0, "ring size must be a power of 2");
+
+    struct Cell
+    {
+        std::atomic<uint32_t> seq;
+        T value;
+    };
+
+    Cell cells[N];
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    std::atomic<uint32_t> pushFailed;
+
+public:
+    EbusMpscRing()
+    {
+        for (uint32_t n = 0; n < N; n++)
+            cells[n].seq.store(n, std::memory_order_relaxed);
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_relaxed);
+        pushFailed.store(0, std::memory_order_relaxed);
+    }
+
+    // any task
+    bool Push(T const &value)
+    {
+        uint32_t pos = head.load(std::memory_order_relaxed);
+        while (true) {
+            auto &cell = cells[pos & (N - 1)];
+            uint32_t seq = cell.seq.load(std::memory_order_acquire);
+            int32_t diff = (int32_t)(seq - pos);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.value = value;
+                    cell.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                pushFailed.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // consumer task only, look at the next entry without taking it
+    bool Peek(T &value) const
+    {
+        uint32_t pos = tail.load(std::memory_order_relaxed);
+        auto &cell = cells[pos & (N - 1)];
+        uint32_t seq = cell.seq.load(std::memory_order_acquire);
+        if ((int32_t)(seq - (pos + 1)) < 0)
+            return false;
+        value = cell.value;
+        return true;
+    }
+
+    // consumer task only
+    bool Pop(T &value)
+    {
+        if (!Peek(value))
+            return false;
+        uint32_t pos = tail.load(std::memory_order_relaxed);
+        cells[pos & (N - 1)].seq.store(pos + N, std::memory_order_release);
+        tail.store(pos + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // approximate when producers are active
+    size_t Size() const { return head.load(std::memory_order_relaxed) - tail.load(std::memory_order_relaxed); }
+    static size_t Capacity() { return N; }
+    uint32_t GetPushFailed() const { return pushFailed.load(std::memory_order_relaxed); }
+};
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "ebus_value.h"
+
+// Payload layouts described as a list of fields, the encoder and decoder
+// are generated from it. Offsets and the payload size are compile time
+// constants: encoding reserves the whole payload once and stores every
+// field at its offset, decoding checks the length once.
+//
+//   typedef EbusSchema<EbusData2c, EbusByte, EbusByte> Status;
+//   Status::Encode(response, flowTemp, pressure, state);
+//   Status::Decode(msg, flowTemp, pressure, state);
+
+struct EbusByte
+{
+    typedef uint8_t type;
+    static const int size = 1;
+    static void Encode(uint8_t *p, type v) { p[0] = v; }
+    static void Decode(const uint8_t *p, type &v) { v = p[0]; }
+};
+
+struct EbusWord
+{
+    typedef uint16_t type;
+    static const int size = 2;
+    static void Encode(uint8_t *p, type v) { p[0] = v; p[1] = v >> 8; }
+    static void Decode(const uint8_t *p, type &v) { v = p[0] | (p[1] << 8); }
+};
+
+struct EbusBCD
+{
+    typedef uint8_t type;
+    static const int size = 1;
+    static void Encode(uint8_t *p, type v) { p[0] = EbusToBCD(v); }
+    static void Decode(const uint8_t *p, type &v) { v = EbusFromBCD(p[0]); }
+};
+
+struct EbusData1c
+{
+    typedef EbusFixed type;
+    static const int size = 1;
+    static void Encode(uint8_t *p, type v)
+    {
+        p[0] = v.IsValid() ? (uint8_t)v.Halves() : Ebus::BYTE_REPLACEMENT;
+    }
+    static void Decode(const uint8_t *p, type &v)
+    {
+        v = p[0] == Ebus::BYTE_REPLACEMENT ? EbusFixed() : EbusFixed::FromHalves(p[0]);
+    }
+};
+
+struct EbusData2b
+{
+    typedef EbusFixed type;
+    static const int size = 2;
+    static void Encode(uint8_t *p, type v)
+    {
+        EbusWord::Encode(p, v.IsValid() ? (uint16_t)v.Raw() : (uint16_t)Ebus::SWORD_REPLACEMENT);
+    }
+    static void Decode(const uint8_t *p, type &v)
+    {
+        int16_t w = p[0] | (p[1] << 8);
+        v = w == Ebus::SWORD_REPLACEMENT ? EbusFixed() : EbusFixed::FromRaw(w);
+    }
+};
+
+struct EbusData2c
+{
+    typedef EbusFixed type;
+    static const int size = 2;
+    static void Encode(uint8_t *p, type v)
+    {
+        EbusWord::Encode(p, v.IsValid() ? (uint16_t)v.Sixteenths() : (uint16_t)Ebus::SWORD_REPLACEMENT);
+    }
+    static void Decode(const uint8_t *p, type &v)
+    {
+        int16_t w = p[0] | (p[1] << 8);
+        v = w == Ebus::SWORD_REPLACEMENT ? EbusFixed() : EbusFixed::FromSixteenths(w);
+    }
+};
+
+struct EbusEXP
+{
+    typedef EbusFixed type;
+    static const int size = 4;
+    static void Encode(uint8_t *p, type v)
+    {
+        uint32_t bits = v.ToExp();
+        p[0] = bits;
+        p[1] = bits >> 8;
+        p[2] = bits >> 16;
+        p[3] = bits >> 24;
+    }
+    static void Decode(const uint8_t *p, type &v)
+    {
+        v = EbusFixed::FromExp(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+    }
+};
+
+// the fields from Offset on
+template<int Offset, typename... Fields>
+struct EbusFieldsAt
+{
+    static const int end = Offset;
+    static void Encode(uint8_t *p) {}
+    static void Decode(const uint8_t *p) {}
+};
+
+template<int Offset, typename Field, typename... Rest>
+struct EbusFieldsAt<Offset, Field, Rest...>
+{
+    typedef EbusFieldsAt<Offset + Field::size, Rest...> Next;
+    static const int end = Next::end;
+
+    static void Encode(uint8_t *p, typename Field::type v, typename Rest::type... rest)
+    {
+        Field::Encode(p + Offset, v);
+        Next::Encode(p, rest...);
+    }
+
+    static void Decode(const uint8_t *p, typename Field::type &v, typename Rest::type &... rest)
+    {
+        Field::Decode(p + Offset, v);
+        Next::Decode(p, rest...);
+    }
+};
+
+template<typename... Fields>
+struct EbusSchema
+{
+    typedef EbusFieldsAt<0, Fields...> Layout;
+    static const int size = Layout::end;
+    static_assert(size <= EBUS_MAX_PAYLOAD, "payload too long for a frame");
+
+    // appended to the payload, false when it doesn't fit
+    template<typename Buffer>
+    static bool Encode(Buffer &buffer, typename Fields::type... values)
+    {
+        auto p = buffer.Reserve(size);
+        if (!p)
+            return false;
+        Layout::Encode(p, values...);
+        return true;
+    }
+
+    // from payload byte offset on, false when the payload is too short
+    template<typename Buffer>
+    static bool DecodeAt(Buffer const &buffer, int offset, typename Fields::type &... values)
+    {
+        if (buffer.GetPayloadLength() < offset + size)
+            return false;
+        Layout::Decode(buffer.GetPayload() + offset, values...);
+        return true;
+    }
+
+    template<typename Buffer>
+    static bool Decode(Buffer const &buffer, typename Fields::type &... values)
+    {
+        return DecodeAt(buffer, 0, values...);
+    }
+};
@@ -0,0 +1,286 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ebus.h"
+#include "ebus_dev.h"
+#include "ebus_stats.h"
+
+void EbusBusStats::Clear()
+{
+    memset(addresses, 0, sizeof(addresses));
+    memset(commands, 0, sizeof(commands));
+    addressOverflow = 0;
+    commandOverflow = 0;
+
+    second = 0;
+    secondBytes = 0;
+    lastSecond = 0;
+    memset(seconds, 0, sizeof(seconds));
+    minuteBytes = 0;
+    memset(minutes, 0, sizeof(minutes));
+    secondIndex = 0;
+    minuteIndex = 0;
+
+    ClearLatency();
+}
+
+void EbusBusStats::ClearLatency()
+{
+    for (auto &slave : slaves) {
+        slave.used = false;
+        slave.ack.Clear();
+    }
+    response.Clear();
+    txWait.Clear();
+    txTotal.Clear();
+}
+
+EbusAddressStats *EbusBusStats::Address(uint8_t addr)
+{
+    for (int n = 0; n < EBUS_STATS_ADDRESSES; n++) {
+        auto &entry = addresses[(addr + n) % EBUS_STATS_ADDRESSES];
+        if (entry.used && entry.addr == addr)
+            return &entry;
+        if (!entry.used) {
+            entry.used = true;
+            entry.addr = addr;
+            return &entry;
+        }
+    }
+    addressOverflow++;
+    return nullptr;
+}
+
+EbusCommandStats *EbusBusStats::Command(uint16_t cmd)
+{
+    unsigned hash = (cmd ^ (cmd >> 8)) % EBUS_STATS_COMMANDS;
+    for (int n = 0; n < EBUS_STATS_COMMANDS; n++) {
+        auto &entry = commands[(hash + n) % EBUS_STATS_COMMANDS];
+        if (entry.used && entry.cmd == cmd)
+            return &entry;
+        if (!entry.used) {
+            entry.used = true;
+            entry.cmd = cmd;
+            return &entry;
+        }
+    }
+    commandOverflow++;
+    return nullptr;
+}
+
+void EbusBusStats::Roll(int64_t sec)
+{
+    // a long gap only has to clear the windows once
+    int64_t steps = sec - second;
+    if (steps > 60 * 16)
+        steps = 60 * 16;
+    second = sec;
+
+    while (steps-- > 0) {
+        lastSecond = secondBytes;
+        seconds[secondIndex] = secondBytes;
+        minuteBytes += secondBytes;
+        secondBytes = 0;
+        if (++secondIndex == 60) {
+            secondIndex = 0;
+            minutes[minuteIndex] = minuteBytes;
+            minuteBytes = 0;
+            if (++minuteIndex == 15)
+                minuteIndex = 0;
+        }
+    }
+}
+
+void EbusBusStats::Byte(int64_t now, bool syn)
+{
+    if (syn && clearRequest.load(std::memory_order_relaxed)) {
+        auto what = clearRequest.exchange(0);
+        if (what & ClearAll)
+            Clear();
+        else
+            ClearLatency();
+    }
+
+    int64_t sec = now / 1000000;
+    // bytes of a burst are dated back, never roll backwards
+    if (sec > second)
+        Roll(sec);
+    if (!syn)
+        secondBytes++;
+}
+
+void EbusBusStats::Request(EbusMessage const &msg)
+{
+    auto len = msg.GetBufferLength();
+    bool valid = msg.IsValidCRC();
+
+    auto src = Address(msg.GetSource());
+    if (src) {
+        src->source++;
+        src->bytes += len;
+        if (!valid)
+            src->crc++;
+    }
+    auto dst = Address(msg.GetDest());
+    if (dst)
+        dst->dest++;
+
+    auto cmd = Command(msg.GetCmd());
+    if (cmd) {
+        cmd->frames++;
+        cmd->bytes += len;
+        if (!valid)
+            cmd->crc++;
+    }
+}
+
+void EbusBusStats::Nak(EbusMessage const &msg)
+{
+    auto dst = Address(msg.GetDest());
+    if (dst)
+        dst->nak++;
+    auto cmd = Command(msg.GetCmd());
+    if (cmd)
+        cmd->nak++;
+}
+
+void EbusBusStats::NoAck(EbusMessage const &msg)
+{
+    auto dst = Address(msg.GetDest());
+    if (dst)
+        dst->noAck++;
+    auto cmd = Command(msg.GetCmd());
+    if (cmd)
+        cmd->noAck++;
+}
+
+void EbusBusStats::Response(EbusMessage const &msg, EbusResponse const &response, uint32_t latency)
+{
+    auto len = response.GetBufferLength();
+    bool valid = response.IsValidCRC();
+
+    auto dst = Address(msg.GetDest());
+    if (dst) {
+        dst->bytes += len;
+        if (!valid)
+            dst->crc++;
+    }
+    auto cmd = Command(msg.GetCmd());
+    if (cmd) {
+        cmd->bytes += len;
+        if (!valid) {
+            cmd->crc++;
+        } else {
+            cmd->responses++;
+            cmd->latencySum += latency;
+            if (latency > cmd->latencyMax)
+                cmd->latencyMax = latency;
+        }
+    }
+}
+
+void EbusBusStats::ArbitrationLost(uint8_t addr)
+{
+    auto src = Address(addr);
+    if (src)
+        src->arbLost++;
+}
+
+void EbusBusStats::SlaveAck(uint8_t addr, int64_t latency)
+{
+    for (auto &slave : slaves) {
+        if (slave.used && slave.addr != addr)
+            continue;
+        slave.used = true;
+        slave.addr = addr;
+        slave.ack.Add(latency);
+        return;
+    }
+}
+
+void EbusBusStats::Transaction(EbusTransaction const &tx)
+{
+    if (!tx.wonAt)
+        return;
+    txWait.Add(tx.wonAt - tx.queuedAt);
+    if (tx.outcome == EbusTxOutcome::Success)
+        txTotal.Add(tx.doneAt - tx.queuedAt);
+}
+
+void EbusBusStats::GetUtilisation(uint16_t util[3]) const
+{
+    uint32_t minute = 0;
+    for (auto bytes : seconds)
+        minute += bytes;
+    uint32_t quarter = 0;
+    for (auto bytes : minutes)
+        quarter += bytes;
+
+    util[0] = (uint64_t)lastSecond * EBUS_BYTE_US / 1000;
+    util[1] = (uint64_t)minute * EBUS_BYTE_US / (60 * 1000);
+    util[2] = (uint64_t)quarter * EBUS_BYTE_US / (900 * 1000);
+}
+
+void EbusBusStats::print() const
+{
+    uint16_t util[3];
+    GetUtilisation(util);
+    printf("util 1s:%d.%d%% 1m:%d.%d%% 15m:%d.%d%%\r\n",
+        util[0] / 10, util[0] % 10, util[1] / 10, util[1] % 10, util[2] / 10, util[2] % 10);
+
+    printf("addr     src    dst    bytes  nak  crc noack  arb-\r\n");
+    for (auto &entry : addresses) {
+        if (!entry.used)
+            continue;
+        printf("  %02x %6u %6u %8u %4u %4u %5u %5u\r\n", entry.addr, entry.source, entry.dest,
+            entry.bytes, entry.nak, entry.crc, entry.noAck, entry.arbLost);
+    }
+
+    printf("cmd    frames    bytes  nak  crc noack  lat-avg lat-max\r\n");
+    for (auto &entry : commands) {
+        if (!entry.used)
+            continue;
+        printf("%04x %8u %8u %4u %4u %5u %8u %7u\r\n", entry.cmd, entry.frames, entry.bytes,
+            entry.nak, entry.crc, entry.noAck,
+            entry.responses ? entry.latencySum / entry.responses : 0, entry.latencyMax);
+    }
+
+    if (addressOverflow || commandOverflow)
+        printf("overflow addr:%u cmd:%u\r\n", addressOverflow, commandOverflow);
+}
+
+void EbusBusStats::PrintLatency() const
+{
+    printf("us            count      p50      p90      p99      max\r\n");
+    for (auto &slave : slaves) {
+        if (!slave.used)
+            continue;
+        char name[12];
+        snprintf(name, sizeof(name), "ack %02x", slave.addr);
+        slave.ack.print(name);
+    }
+    response.print("response");
+    txWait.print("tx wait");
+    txTotal.print("tx total");
+}
+
+// one line of JSON with the bus wide totals
+int EbusBusStats::FormatCompact(char *buf, size_t len) const
+{
+    uint32_t frames = 0, nak = 0, crc = 0, noAck = 0, arbLost = 0;
+    for (auto &entry : addresses) {
+        frames += entry.source;
+        nak += entry.nak;
+        crc += entry.crc;
+        noAck += entry.noAck;
+        arbLost += entry.arbLost;
+    }
+
+    uint16_t util[3];
+    GetUtilisation(util);
+    return snprintf(buf, len,
+        "{\"util\":[%d.%d,%d.%d,%d.%d],\"frames\":%u,\"nak\":%u,\"crc\":%u,\"noack\":%u,\"arblost\":%u}",
+        util[0] / 10, util[0] % 10, util[1] / 10, util[1] % 10, util[2] / 10, util[2] % 10,
+        frames, nak, crc, noAck, arbLost);
+}
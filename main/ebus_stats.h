@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+#include "ebus_histogram.h"
+
+#define EBUS_STATS_ADDRESSES 16
+#define EBUS_STATS_COMMANDS 24
+#define EBUS_STATS_SLAVES 6
+
+struct EbusAddressStats
+{
+    uint8_t addr;
+    bool used;
+    uint32_t source;    // frames sent, each one won arbitration
+    uint32_t dest;      // frames addressed to it
+    uint32_t bytes;     // requests sent and responses given
+    uint32_t nak;
+    uint32_t crc;
+    uint32_t noAck;
+    uint32_t arbLost;   // only seen for our own addresses
+};
+
+struct EbusCommandStats
+{
+    uint16_t cmd;
+    bool used;
+    uint32_t frames;
+    uint32_t bytes;
+    uint32_t nak;
+    uint32_t crc;
+    uint32_t noAck;
+    uint32_t responses;
+    uint32_t latencySum;    // us from the request CRC to the response CRC
+    uint32_t latencyMax;
+};
+
+// our own slaves, from the request CRC to the ACK we sent coming back
+struct EbusSlaveLatency
+{
+    uint8_t addr;
+    bool used;
+    EbusHistogram ack;
+};
+
+// Traffic counters for one bus, updated by the bus task. Addresses and
+// commands go into fixed open addressed tables, whatever doesn't fit is
+// only counted as overflow. Utilisation is the share of bus time taken by
+// bytes other than SYN, over the last second, minute and 15 minutes.
+// Other tasks only read them, a figure may be an event behind another;
+// clearing is asked for and done by the bus task at the next SYN.
+class EbusBusStats
+{
+    enum { ClearAll = 1, ClearLatencyOnly = 2 };
+    std::atomic<uint8_t> clearRequest;
+
+    EbusAddressStats addresses[EBUS_STATS_ADDRESSES];
+    EbusCommandStats commands[EBUS_STATS_COMMANDS];
+    uint32_t addressOverflow;
+    uint32_t commandOverflow;
+
+    int64_t second;         // current second since boot
+    uint32_t secondBytes;   // so far in the current second
+    uint32_t lastSecond;    // in the last whole second
+    uint16_t seconds[60];   // last minute, by second
+    uint32_t minuteBytes;   // so far in the current minute
+    uint32_t minutes[15];   // last 15 minutes, by minute
+    uint8_t secondIndex;
+    uint8_t minuteIndex;
+
+    EbusSlaveLatency slaves[EBUS_STATS_SLAVES];
+    EbusHistogram response;     // our slaves, request CRC to response CRC
+    EbusHistogram txWait;       // our frames, queued to won arbitration
+    EbusHistogram txTotal;      // our frames, queued to done, successful only
+
+    EbusAddressStats *Address(uint8_t addr);
+    EbusCommandStats *Command(uint16_t cmd);
+    void Roll(int64_t sec);
+    void Clear();
+    void ClearLatency();
+
+public:
+    EbusBusStats() : clearRequest(0) { Clear(); }
+
+    // any task
+    void RequestClear() { clearRequest.fetch_or(ClearAll); }
+    void RequestClearLatency() { clearRequest.fetch_or(ClearLatencyOnly); }
+
+    // every byte on the bus, SYN included so the clock keeps moving
+    void Byte(int64_t now, bool syn);
+    void Request(EbusMessage const &msg);
+    void Nak(EbusMessage const &msg);
+    void NoAck(EbusMessage const &msg);
+    void Response(EbusMessage const &msg, EbusResponse const &response, uint32_t latency);
+    void ArbitrationLost(uint8_t addr);
+
+    void SlaveAck(uint8_t addr, int64_t latency);
+    void SlaveResponse(int64_t latency) { response.Add(latency); }
+    void Transaction(EbusTransaction const &tx);
+
+    // per mille of bus time over 1, 60 and 900 seconds
+    void GetUtilisation(uint16_t util[3]) const;
+
+    void print() const;
+    void PrintLatency() const;
+    int FormatCompact(char *buf, size_t len) const;
+};
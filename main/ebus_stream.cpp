@@ -0,0 +1,487 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ebus.h"
+#include "ebus_dev.h"
+#include "ebus_stream.h"
+#include "ebus_log.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define SYN_Time 50
+#define SYN_Timeout(m) ((masterAddress * 10 + 10 + SYN_Time)/ portTICK_PERIOD_MS)
+
+uint8_t masterAddress = EBUS_ADDR(2,1); // 0x71
+uint8_t lock_max = 5;
+uint8_t lock_counter;
+
+void EbusBusStream::SynSendTimerCallback()
+{
+    if ( !synMaster ) {
+        EbusLog(EbusLogEvent::BecameSynMaster);
+        xTimerChangePeriod( synTimer, SYN_Time /portTICK_PERIOD_MS, 0 );
+        synMaster = true;
+    }
+    SendSYN();
+    synTime = esp_log_early_timestamp();
+}
+
+void EbusBusStream::SynRecieved(bool expected)
+{
+    if ( synMaster && !expected) {
+        // has someone else sent a syn
+        uint32_t now = esp_log_early_timestamp();
+        if ((now-synTime) > 10) {
+            synMaster = false;
+            xTimerChangePeriod( synTimer, SYN_Timeout(masterAddress), 0);
+            EbusLog(EbusLogEvent::OtherSyn);
+        }
+    }
+}
+
+bool EbusBusStream::QueueTransaction(EbusTransactionPtr tx, EbusTxClass cls)
+{
+    if (!tx || !tx->msg)
+        return false;
+    if (!txQueue.Push(tx, cls)) {
+        ESP_LOGI(TAG, "queue full");
+        return false;
+    }
+    return true;
+}
+
+void EbusBusStream::PrintStats()
+{
+    txQueue.print();
+
+    auto &o = counters.outcome;
+    printf("tx ok:%u nak:%u noack:%u arb:%u timeout:%u crc:%u collision:%u\r\n",
+        o[(int)EbusTxOutcome::Success], o[(int)EbusTxOutcome::Nak], o[(int)EbusTxOutcome::NoAck],
+        o[(int)EbusTxOutcome::LostArbitration], o[(int)EbusTxOutcome::Timeout], o[(int)EbusTxOutcome::CrcError],
+        o[(int)EbusTxOutcome::Collision]);
+
+    auto &t = counters.timeout;
+    printf("timeout req:%u ack:%u resp:%u rack:%u arb:%u repeat req:%u resp:%u collision:%u\r\n",
+        t[(int)EbusRxState::Request], t[(int)EbusRxState::RequestAck], t[(int)EbusRxState::Response],
+        t[(int)EbusRxState::ResponseAck], t[(int)EbusRxState::Arbitration],
+        counters.requestRepeat, counters.responseRepeat, counters.collision);
+}
+
+void EbusBusStream::start()
+{
+    TickType_t synTimeout = SYN_Timeout(masterAddress);
+    synTimer = xTimerCreate("syn", synTimeout, true, this, SynSendTimerCallback);
+    xTimerStart( synTimer, 0);
+
+    xTaskCreate(ebusTaskCallback, "ebus", 2000, this, 5, &ebusTask);
+
+}
+
+// never more than one byte ahead of the echo, so a collision stops us
+// after the byte that hit it
+void EbusBusStream::SendWire(EbusWire &wire)
+{
+    echo = &wire;
+    if (SendEchoed(wire.GetData(), wire.GetSent(), wire.GetLength())) {
+        // the uart has it all, the echo is still checked here
+        int count;
+        wire.TakeUnsent(count);
+        return;
+    }
+    SendNext();
+}
+
+void EbusBusStream::SendNext()
+{
+    if (!echo->EchoDone() || !echo->HasUnsent())
+        return;
+    int count;
+    auto data = echo->TakeUnsent(count, 1);
+    SendData(data, count);
+}
+
+// someone else is on the bus, what we sent so far is broken for everybody
+void EbusBusStream::Collision(uint8_t seen, uint8_t sent)
+{
+    counters.collision++;
+    EbusLog(EbusLogEvent::Collision, seen, sent);
+    bool ours = echo == &txWire && active;
+    echo = nullptr;
+    if (ours) {
+        // back to waiting for arbitration, the frame is still encoded
+        cmd = std::move(active);
+        Retry(EbusTxOutcome::Collision);
+    }
+    state = EbusRxState::Error;
+}
+
+void EbusBusStream::ProcessResponse(EbusMessage const &msg, EbusResponse const &response)
+{
+    // a request with a bad CRC still gets its response parsed, it isn't passed on
+    if (msg.IsValidCRC()) {
+        for( auto monitor : monitors)
+            monitor->Notify(msg, response);
+    }
+
+    EbusBusData::ProcessResponse(msg, response);
+}
+
+
+// our slave answers the NAKed response once more, from its template when
+// the uart sent it and the response wire never had it
+void EbusBusStream::RepeatResponse(EbusMessage const &msg)
+{
+    if (RequestAnswered()) {
+        auto device = GetDevice(msg.GetDest());
+        auto first = msg.GetPayloadLength() ? msg.GetPayload()[0] : 0;
+        auto tmpl = device->FindTemplate(msg.GetCmd(), msg.GetPayloadLength(), first);
+        if (!tmpl)
+            return;
+        LoadTemplate(*tmpl);
+    }
+    EbusBusData::RepeatResponse();
+}
+
+// the frame we were waiting for lost arbitration, retry a few times
+void EbusBusStream::ArbitrationLost()
+{
+    stats.ArbitrationLost(cmd->msg->GetSource());
+    Retry(EbusTxOutcome::LostArbitration);
+}
+
+// cmd goes again after a few SYNs, unless it ran out of retries
+void EbusBusStream::Retry(EbusTxOutcome outcome)
+{
+    lock_counter = lock_max;
+    if ( cmd_retry-- == 0) {
+        counters.outcome[(int)outcome]++;
+        cmd->Complete(outcome);
+        stats.Transaction(*cmd);
+        cmd.reset();
+    }
+}
+
+// our transaction is over, report it and give the bus back with a SYN
+void EbusBusStream::Finish(EbusTxOutcome outcome, EbusResponse const *response, bool release)
+{
+    if (!active)
+        return;
+    counters.outcome[(int)outcome]++;
+    // the bus is free before the callback runs
+    if (release)
+        SendSYN();
+    active->Complete(outcome, response);
+    stats.Transaction(*active);
+    active.reset();
+}
+
+static int64_t StateTimeout(EbusRxState state)
+{
+    switch (state) {
+        case EbusRxState::Request:
+        case EbusRxState::Arbitration:
+            return EBUS_GAP_TIMEOUT_US;
+        case EbusRxState::RequestAck:
+        case EbusRxState::Response:
+        case EbusRxState::ResponseAck:
+            return EBUS_ANSWER_TIMEOUT_US;
+        default:
+            return 0;
+    }
+}
+
+void EbusBusStream::ebusTaskCallback()
+{
+    ESP_LOGI(TAG,"ebus starting");
+
+    for(auto dev : devices) {
+        ESP_LOGI(TAG,"starting %s", dev->GetName());
+        dev->start();
+    }
+
+    uint8_t data[EBUS_RX_BURST];
+    while(true) {
+        int len = ReadBytes(data, sizeof(data));
+        if (len < 0) {
+            ESP_LOGE(TAG, "uart read failed");
+            break;
+        }
+        if (len == 0) {
+            CheckDeadline(esp_timer_get_time());
+            continue;
+        }
+        ProcessBytes(data, len);
+    }
+}
+
+void EbusBusStream::CheckDeadline(int64_t now)
+{
+    if (deadline && now > deadline) {
+        counters.timeout[(int)state]++;
+        if (state == EbusRxState::RequestAck)
+            stats.NoAck(request);
+        EbusLog(EbusLogEvent::Timeout, (uint8_t)state);
+        if (state == EbusRxState::Arbitration)
+            ArbitrationLost();
+        else
+            Finish(state == EbusRxState::RequestAck ? EbusTxOutcome::NoAck : EbusTxOutcome::Timeout);
+        state = EbusRxState::Error;
+        deadline = 0;
+        EbusTrace(EbusTraceEvent::State, (uint8_t)state);
+    }
+}
+
+// a burst as read from the uart, the last byte has just arrived and each
+// one before it a byte time earlier
+void EbusBusStream::ProcessBytes(const uint8_t *data, size_t len)
+{
+    int64_t now = esp_timer_get_time();
+    for (size_t n = 0; n < len; n++)
+        ProcessByte(data[n], now - (int64_t)(len - 1 - n) * EBUS_BYTE_US);
+    SynRetrigger();
+}
+
+void EbusBusStream::ProcessByte(uint8_t c, int64_t now)
+{
+    CheckDeadline(now);
+
+    EbusTrace(EbusTraceEvent::Rx, c);
+    stats.Byte(now, c == SYN);
+
+    // our own bytes coming back, anything else means someone talked over us
+    if (echo) {
+        auto sent = echo->Expected();
+        if (!echo->Echo(c)) {
+            Collision(c, sent);
+            // the rest is ignored until the SYN
+        } else if (echo->HasUnsent()) {
+            SendNext();
+        } else if (echo->EchoDone()) {
+            echo = nullptr;
+        }
+    }
+
+    auto tracedState = state;
+    if (c==SYN) {
+        auto oldstate = state;
+        echo = nullptr;
+        state = EbusRxState::Request;
+        deadline = 0;
+        esc = false;
+        requestRepeated = false;
+        responseRepeated = false;
+
+        if (oldstate == EbusRxState::Arbitration) {
+            EbusLog(EbusLogEvent::ArbitrationLost, c, cmd->msg->GetSource());
+            ArbitrationLost();
+        }
+        if (oldstate == EbusRxState::RequestAck)
+            stats.NoAck(request);
+        // our frame ended without an outcome, the bus is already free
+        Finish(oldstate == EbusRxState::RequestAck ? EbusTxOutcome::NoAck : EbusTxOutcome::Timeout,
+            nullptr, false);
+
+        // asked on every SYN, it keeps count
+        if (SynArbitrated() && cmd) {
+            // the uart already put our source out after this SYN
+            arbArmed = false;
+            state = EbusRxState::Arbitration;
+            deadline = now + StateTimeout(state);
+        } else if ( lock_counter == 0 ) {
+            if (!cmd) {
+                cmd = txQueue.Pop();
+                cmd_retry = 3;
+                // encoded once, kept for the retries and a repeat after NAK
+                if (cmd) {
+                    txWire.Reset();
+                    if (cmd->msg->GetFrame())
+                        txWire.Point(*cmd->msg->GetFrame());
+                    else
+                        txWire.Encode(*cmd->msg);
+                }
+            }
+            if (cmd && !arbArmed) {
+                if (ArmArbitration(cmd->msg->GetSource())) {
+                    // goes out on the next SYN
+                    arbArmed = true;
+                } else {
+                    // send Source - arb
+                    SendChar(cmd->msg->GetSource());
+                    state = EbusRxState::Arbitration;
+                    deadline = now + StateTimeout(state);
+                }
+            }
+        } else {
+            lock_counter--;
+        }
+        // the master sends SYN on end of no tansactions
+        // either completion of 'timeout'
+        SynRecieved(oldstate == EbusRxState::Done || oldstate == EbusRxState::RequestAck);
+
+        switch (oldstate) {
+            case EbusRxState::Request:
+                if (!request.IsEmpty()) {
+                    EbusLogFrame(EbusLogEvent::Incomplete, request.GetBuffer(), request.GetBufferLength());
+                }
+                break;
+            case EbusRxState::RequestAck:
+                EbusLog(EbusLogEvent::NoSlaveAck);
+                break;
+            case EbusRxState::Response:
+                EbusLogFrame(EbusLogEvent::FailedResponse, response.GetBuffer(), response.GetWrittenLen(),
+                    response.GetWrittenLen());
+                break;
+            case EbusRxState::ResponseAck:
+                EbusLog(EbusLogEvent::NoMasterAck);
+                break;
+            case EbusRxState::Done:
+            case EbusRxState::Error:
+            case EbusRxState::Arbitration:
+                break;
+        }
+        request.Reset();
+        response.Reset();
+    } else if (c == ESC) {
+        esc = true;
+    } else {
+        if ( esc ) {
+            if ( c == 0 )
+                c = ESC;
+            else if (c==1)
+                c = SYN;
+            esc = false;
+        }
+        switch(state)
+        {
+            case EbusRxState::Request:
+                if (request.Write(c)) {
+                    stats.Request(request);
+                    requestDone = now;
+                    if (request.GetDest() == BROADCAST_ADDR) {
+                        if (!request.IsValidCRC()) {
+                            EbusLogFrame(EbusLogEvent::BadRequest, request.GetBuffer(), request.GetBufferLength());
+                            Finish(EbusTxOutcome::CrcError);
+                            state = EbusRxState::Error;
+                        } else {
+                            EbusLogFrame(EbusLogEvent::Broadcast, request.GetBuffer(), request.GetBufferLength());
+                            ProcessMessage(request);
+                            Finish(EbusTxOutcome::Success);
+                            state = EbusRxState::Done;
+                        }
+                    } else {
+                        // a bad CRC gets NAKed by the slave and the request repeated
+                        EbusLogFrame(request.IsValidCRC() ? EbusLogEvent::Request : EbusLogEvent::BadRequest,
+                            request.GetBuffer(), request.GetBufferLength());
+                        // the uart may have answered from a template already
+                        if (!RequestAnswered())
+                            ProcessMessage(request);
+                        state = EbusRxState::RequestAck;
+                    }
+                }
+                break;
+            case EbusRxState::RequestAck:
+                if (GetDevice(request.GetDest()))
+                    stats.SlaveAck(request.GetDest(), now - requestDone);
+                if (c == ACK) {
+                    if (EBUS_ADDR_CLASS[request.GetDest()] == EBUS_ADDR_MASTER) {
+                        Finish(EbusTxOutcome::Success);
+                        state = EbusRxState::Done;
+                    } else {
+                        state = EbusRxState::Response;
+                    }
+                } else if (c == NAK && !requestRepeated) {
+                    EbusLog(EbusLogEvent::NakRepeat);
+                    stats.Nak(request);
+                    requestRepeated = true;
+                    counters.requestRepeat++;
+                    request.Reset();
+                    state = EbusRxState::Request;
+                    if (active) {
+                        // the whole request again, no new arbitration
+                        txWire.Rewind();
+                        SendWire(txWire);
+                    }
+                } else if (c == NAK) {
+                    EbusLog(EbusLogEvent::Nak);
+                    stats.Nak(request);
+                    Finish(EbusTxOutcome::Nak);
+                    state = EbusRxState::Error;
+                } else {
+                    EbusLog(EbusLogEvent::NotAck, c);
+                    stats.NoAck(request);
+                    Finish(EbusTxOutcome::NoAck);
+                    state = EbusRxState::Error;
+                }
+                break;
+            case EbusRxState::Response:
+                if (response.Write(c)) {
+                    stats.Response(request, response, now - requestDone);
+                    if (GetDevice(request.GetDest()))
+                        stats.SlaveResponse(now - requestDone);
+                    bool ours = active || GetDevice(request.GetSource());
+                    if (!response.IsValidCRC()) {
+                        // the master NAKs and the slave repeats
+                        EbusLog(EbusLogEvent::BadResponse);
+                        if (ours)
+                            SendNAK();
+                    } else {
+                        EbusLogFrame(EbusLogEvent::Response, response.GetBuffer(), response.GetBufferLength());
+                        ProcessResponse(request, response);
+                        // a device at the source acks for itself
+                        if (active && !GetDevice(request.GetSource()))
+                            SendACK();
+                    }
+                    state = EbusRxState::ResponseAck;
+                }
+                break;
+            case EbusRxState::ResponseAck:
+                if (c == ACK) {
+                    if (response.IsValidCRC())
+                        Finish(EbusTxOutcome::Success, &response);
+                    else
+                        Finish(EbusTxOutcome::CrcError);
+                    state = EbusRxState::Done;
+                } else if (c == NAK && !responseRepeated) {
+                    EbusLog(EbusLogEvent::ResponseNakRepeat);
+                    responseRepeated = true;
+                    counters.responseRepeat++;
+                    response.Reset();
+                    state = EbusRxState::Response;
+                    if (GetDevice(request.GetDest()))
+                        RepeatResponse(request);
+                } else {
+                    EbusLog(EbusLogEvent::ResponseNotAck, c);
+                    Finish(EbusTxOutcome::CrcError);
+                    state = EbusRxState::Error;
+                }
+                break;
+            case EbusRxState::Done:
+                EbusLog(EbusLogEvent::Unexpected, c);
+                break;
+            case EbusRxState::Error:
+                break;
+            case EbusRxState::Arbitration:
+                request.Write(c);
+                state = EbusRxState::Request;
+                if (c == cmd->msg->GetSource()) {
+                    // we won arb, the source is already out
+                    cmd->wonAt = esp_timer_get_time();
+                    txWire.Rewind(1);
+                    SendWire(txWire);
+                    active = std::move(cmd);
+                } else {
+                    EbusLog(EbusLogEvent::ArbitrationLost, c, cmd->msg->GetSource());
+                    ArbitrationLost();
+                }
+                break;
+        }
+
+        auto timeout = StateTimeout(state);
+        deadline = timeout ? now + timeout : 0;
+    }
+
+    if (state != tracedState)
+        EbusTrace(EbusTraceEvent::State, (uint8_t)state);
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include "driver/uart.h"
+
+#include "ebus_txsched.h"
+#include "ebus_trace.h"
+#include "ebus_stats.h"
+
+#include <list>
+
+// 0 1 3 7 f
+#define EBUS_ADDR(id,pri) (  (((1<<id)-1)<<4) | ((0x1<<pri)-1) )
+#define EBUS_SLAVE_ADDR(addr) ((uint8_t)(addr+5))
+
+extern uint8_t masterAddress;
+
+// where the receiver is in a frame, the same for frames we send and frames we watch
+enum class EbusRxState : uint8_t {
+    Request,        // QQ ZZ PB SB NN DB* CRC
+    RequestAck,     // ACK/NAK from the slave or master addressed
+    Response,       // NN DB* CRC
+    ResponseAck,    // ACK/NAK from the master
+    Done,           // waiting for SYN
+    Error,          // frame abandoned, waiting for SYN
+    Arbitration,    // our source address sent
+};
+#define EBUS_RX_STATES 7
+
+// longest gap between bytes of one frame
+#define EBUS_GAP_TIMEOUT_US (4 * EBUS_BYTE_US)
+// longest wait for an ACK or the start of the response
+#define EBUS_ANSWER_TIMEOUT_US (10 * EBUS_BYTE_US)
+
+// most bytes taken from the uart in one go
+#define EBUS_RX_BURST 32
+
+// only written by the bus task
+struct EbusBusCounters
+{
+    uint32_t outcome[EBUS_TX_OUTCOMES];  // our transactions
+    uint32_t timeout[EBUS_RX_STATES];    // deadline missed, by state
+    uint32_t requestRepeat;              // request sent again after a NAK
+    uint32_t responseRepeat;             // response sent again after a NAK
+    uint32_t collision;                  // echo differed from what we sent, sending stopped
+};
+
+class EbusBusStream : public EbusBusData
+{
+    TaskHandle_t ebusTask;
+
+    TimerHandle_t synTimer;
+    bool synMaster = false;
+    uint32_t synTime;
+
+    static void SynSendTimerCallback(TimerHandle_t xTimer)
+    {
+        auto bus = (EbusBusStream*)pvTimerGetTimerID(xTimer);
+        bus->SynSendTimerCallback();
+    }
+
+    void SynSendTimerCallback();
+
+    EbusTransactionPtr cmd;     // waiting to win arbitration
+    EbusTransactionPtr active;  // won, waiting for the outcome
+    EbusWire txWire;            // cmd as it goes on the wire
+    EbusWire *echo = nullptr;   // being sent, echo not all back yet
+    int cmd_retry = 0;
+    bool arbArmed = false;      // cmd source handed to ArmArbitration
+    EbusBusCounters counters = {};
+    EbusBusStats stats;
+
+    // receiver, only touched by the bus task
+    EbusMessageWriter request;
+    EbusResponseWriter response;
+    EbusRxState state = EbusRxState::Request;
+    bool esc = false;
+    int64_t deadline = 0;
+    // one repeat each after a NAK
+    bool requestRepeated = false;
+    bool responseRepeated = false;
+    int64_t requestDone = 0;
+
+    void ProcessByte(uint8_t c, int64_t now);
+    void CheckDeadline(int64_t now);
+    void ArbitrationLost();
+    void Retry(EbusTxOutcome outcome);
+    void SendNext();
+    void Collision(uint8_t seen, uint8_t sent);
+    void RepeatResponse(EbusMessage const &msg);
+    void Finish(EbusTxOutcome outcome, EbusResponse const *response = nullptr, bool release = true);
+
+protected:
+    void ProcessResponse(EbusMessage const &msg, EbusResponse const &response);
+    virtual void SendData(const uint8_t *data, int len) = 0;
+    void SendWire(EbusWire &wire);
+    // up to len bytes, waiting a little for the first; 0 when none came, <0 on error
+    virtual int ReadBytes(uint8_t *buf, int len) = 0;
+
+    // Arbitration done by the uart itself: once armed the source goes out
+    // straight after the next SYN that ends the receive FIFO, without
+    // waiting for the bus task. SynArbitrated is called for every SYN the
+    // parser takes, in order, and says whether the source followed it.
+    virtual bool ArmArbitration(uint8_t source) { return false; }
+    virtual bool SynArbitrated() { return false; }
+    // Sending done by the uart itself: each byte goes when the echo of the
+    // one before matched, and nothing more after one that didn't. Hands
+    // over bytes from..len of data, a later call may add to the same data.
+    // False when the uart can't, the bus task then does the same per byte.
+    virtual bool SendEchoed(const uint8_t *data, int from, int len) { return false; }
+    // whether the uart sent a device's template answer to the current request
+    virtual bool RequestAnswered() { return false; }
+
+    void SendSYN()
+    {
+        SendChar(SYN);
+    }
+
+    void SynRecieved(bool expected);
+
+    void SynRetrigger()
+    {
+        xTimerReset(synTimer, 0);
+    }
+
+    // filled from timers, console, ebusd and bridges, drained by the bus task
+    EbusTxScheduler txQueue;
+    std::list<EbusMonitor *> monitors;
+public:
+
+    void AddMonitor(EbusMonitor *mon)
+    {
+        monitors.push_back(mon);
+    }
+
+    bool QueueTransaction(EbusTransactionPtr tx, EbusTxClass cls);
+    void PrintStats();
+    EbusBusStats *GetStats() { return &stats; }
+
+    void start();
+
+    static void ebusTaskCallback(void *args)
+    {
+        auto bus = (EbusBusStream*)args;
+        bus->ebusTaskCallback();
+    }
+
+    void ebusTaskCallback();
+
+    void ProcessBytes(const uint8_t *data, size_t len);
+};
+
+class EbusBusUart : public EbusBusStream
+{
+    uart_port_t uart_num;
+
+    void SendData(const uint8_t*buf, int len)
+    {
+        EbusTrace(EbusTraceEvent::Tx, buf[0], len);
+        uart_tx_chars(uart_num, (const char*)buf, len);
+    }
+
+    // blocks for the first byte, then takes whatever else the driver has buffered
+    int ReadBytes(uint8_t *buf, int len)
+    {
+        int got = uart_read_bytes(uart_num, buf, 1, 10/portTICK_PERIOD_MS);
+        if (got != 1)
+            return got;
+
+        size_t buffered = 0;
+        uart_get_buffered_data_len(uart_num, &buffered);
+        if (buffered > (size_t)len - 1)
+            buffered = len - 1;
+        if (buffered) {
+            int more = uart_read_bytes(uart_num, buf + 1, buffered, 0);
+            if (more < 0)
+                return more;
+            got += more;
+        }
+        return got;
+    }
+public:
+    EbusBusUart(uart_port_t port)
+    {
+        uart_num = port;
+    }
+};
@@ -11,11 +11,16 @@
 #include "ebus.h"
 #include "ebus_dev.h"
 #include "ebus_device.h"
+#include "ebus_stream.h"
+#include "ebus_uart.h"
+#include "ebus_monitor.h"
+#include "ebus_log.h"
+#include "ebus_trace.h"
+#include "ebus_stats.h"
 
 #include "argtable3/argtable3.h"
 #include "esp_console.h"
 
-#include <queue>
 #include <map>
 #include <list>
 
@@ -29,24 +34,9 @@
 #define CONFIG_FREERTOS_HZ 100
 #endif
 
-#define SYN_Time 50
-#define SYN_Timeout(m) ((masterAddress * 10 + 10 + SYN_Time)/ portTICK_PERIOD_MS)
-
 static const char* TAG ="EBUS";
 
-// 0 1 3 7 f
-#define EBUS_ADDR(id,pri) (  (((1<<id)-1)<<4) | ((0x1<<pri)-1) )
-#define EBUS_SLAVE_ADDR(addr) ((uint8_t)(addr+5))
-
-uint8_t masterAddress = EBUS_ADDR(2,1); // 0x71
 uart_port_t uart_num = UART_NUM_0;
-uint8_t lock_max = 5;
-uint8_t lock_counter;
-
-
-int err_mastertolong = 0;
-int err_reqnak = 0;
-int err_notack = 0;
 
 void printhex(const char* msg, const uint8_t*buf, int len)
 {
@@ -56,19 +46,6 @@ void printhex(const char* msg, const uint8_t*buf, int len)
     printf("\r\n");
 }
 
-bool IS_MASTER(uint8_t c)
-{
-    char c1 = c&0xf;
-    if (c1 != 0 && c1 != 1 && c1 != 3 && c1 != 7 && c1 != 0xf)
-        return false;
-    c1 = (c>>4)&0xf;
-    if (c1 != 0 && c1 != 1 && c1 != 3 && c1 != 7 && c1 != 0xf)
-        return false;
-    return true;
-}
-
-
-
 class EbusDeviceDebug : public EbusDeviceBase, public EbusSender
 {
     std::list<EbusMonitor *> monitors;
@@ -106,7 +83,7 @@ public:
                 }
                 case 1:
                     auto outsideTemp = msg.ReadPayloadData2b(1);
-                    printf("Broadcast outside:%d.%d\r\n", (int)outsideTemp, ((int)(outsideTemp*10))%10 );
+                    printf("Broadcast outside:%.1f\r\n", outsideTemp.ToFloat());
                     return;
             }
 
@@ -147,9 +124,10 @@ public:
     
     std::map<EbusMessage, EbusResponse, MsgComp> cache;
 
-    void Send(EbusMessage const &msg)
+    void Send(EbusMessage const &msg, EbusTxCallback cb, void *ctx)
     {
-        if ( !monitors.empty() ) {
+        // a caller waiting for the outcome gets a real bus transaction
+        if ( !cb && !monitors.empty() ) {
             auto p = cache.find(msg);
             if ( p != cache.end()) {
                 for(auto monitor : monitors)
@@ -159,18 +137,29 @@ public:
         }
 
         // clone msg
-        auto sendMsg = new EbusMessage(msg);
-        bus->QueueMessage(sendMsg);
+        auto sendMsg = EbusMessagePtr::Create(msg);
+        if (!sendMsg) {
+            ESP_LOGW(name, "no free message");
+            return;
+        }
+        auto tx = EbusTransactionPtr::Create(std::move(sendMsg), cb, ctx);
+        if (!tx) {
+            ESP_LOGW(name, "no free transaction");
+            return;
+        }
+        bus->QueueTransaction(std::move(tx), EbusTxClass::Interactive);
     }
 
     bool ProcessTimer(int cnt)
     {
         if ((cnt % 60)  == 111){
-            auto msg = new EbusMessage(masterAddress, BROADCAST_ADDR, 0xb516);
-            msg->AddPayload(1);
-            msg->AddPayloadData2b(25.3f);
-            msg->SetCRC();
-            bus->QueueMessage(msg);
+            auto msg = EbusMessagePtr::Create(masterAddress, BROADCAST_ADDR, 0xb516);
+            if (msg) {
+                msg->AddPayload(1);
+                msg->AddPayloadData2b(EbusFixed::FromFloat(25.3f));
+                msg->SetCRC();
+                bus->QueueMessage(std::move(msg));
+            }
     }
         if ((cnt % 60)  == 1){
             auto m = sntp_get_sync_status();
@@ -188,17 +177,19 @@ public:
                 // B:Req: 10 fe b516 (8) Data: 00 46 10 15 05 09 04 24 (cb)
                 // Broadcast datetime: Thu Sep  5 15:10:46 2024
 
-                auto msg = new EbusMessage(masterAddress, BROADCAST_ADDR, 0xb516);
-                msg->AddPayload(0);
-                msg->AddPayloadBCD(t.tm_sec);
-                msg->AddPayloadBCD(t.tm_min);
-                msg->AddPayloadBCD(t.tm_hour);
-                msg->AddPayloadBCD(t.tm_mday);
-                msg->AddPayloadBCD(t.tm_mon+1);
-                msg->AddPayloadBCD(t.tm_wday);
-                msg->AddPayloadBCD(t.tm_year % 100);
-                msg->SetCRC();
-                bus->QueueMessage(msg);
+                auto msg = EbusMessagePtr::Create(masterAddress, BROADCAST_ADDR, 0xb516);
+                if (msg) {
+                    msg->AddPayload(0);
+                    msg->AddPayloadBCD(t.tm_sec);
+                    msg->AddPayloadBCD(t.tm_min);
+                    msg->AddPayloadBCD(t.tm_hour);
+                    msg->AddPayloadBCD(t.tm_mday);
+                    msg->AddPayloadBCD(t.tm_mon+1);
+                    msg->AddPayloadBCD(t.tm_wday);
+                    msg->AddPayloadBCD(t.tm_year % 100);
+                    msg->SetCRC();
+                    bus->QueueMessage(std::move(msg));
+                }
             }
         }
 
@@ -208,339 +199,6 @@ public:
 };
 
 
-class EbusBusStream : public EbusBusData
-{
-    TaskHandle_t ebusTask;
-    
-    TimerHandle_t synTimer;
-    bool synMaster = false;
-    uint32_t synTime;
-
-    static void SynSendTimerCallback(TimerHandle_t xTimer)
-    {
-        auto bus = (EbusBusStream*)pvTimerGetTimerID(xTimer);
-        bus->SynSendTimerCallback();
-    }
-
-    void SynSendTimerCallback()
-    {
-        if ( !synMaster ) {
-            ESP_LOGI(TAG, "becoming SYN");
-            xTimerChangePeriod( synTimer, SYN_Time /portTICK_PERIOD_MS, 0 );
-            synMaster = true;
-        }
-        SendSYN();
-        synTime = esp_log_early_timestamp();
-    }
-
-
-protected:
-    void ProcessResponse(EbusMessage const &msg, EbusResponse const &response);
-    virtual void SendData(const uint8_t *data, int len) = 0;
-    virtual int ReadByte() = 0;
-
-    void SendSYN()
-    {
-        SendChar(SYN);
-    }
-
-    void SynRecieved(bool expected)
-    {
-        if ( synMaster && !expected) {
-            // has someone else sent a syn
-            uint32_t now = esp_log_early_timestamp();
-            if ((now-synTime) > 10) {
-                synMaster = false;
-                xTimerChangePeriod( synTimer, SYN_Timeout(masterAddress), 0);
-                ESP_LOGI(TAG, "recevied other SYN");
-            }
-        }
-    }
-
-    void SynRetrigger()
-    {
-        xTimerReset(synTimer, 0);
-    }
-
-    std::queue<const EbusMessage*> cmd_queue;
-    std::list<EbusMonitor *> monitors;
-public:
-
-    void AddMonitor(EbusMonitor *mon)
-    {
-        monitors.push_back(mon);
-    }
-
-    void QueueMessage(const EbusMessage *msg)
-    {
-        if (cmd_queue.size() > 10) {
-            ESP_LOGI(TAG, "queue full");
-            delete msg;
-            return;
-        }
-        cmd_queue.push(msg);
-    }
-
-
-    void start()
-    {
-        TickType_t synTimeout = SYN_Timeout(masterAddress);
-        synTimer = xTimerCreate("syn", synTimeout, true, this, SynSendTimerCallback);
-        xTimerStart( synTimer, 0);
-
-        xTaskCreate(ebusTaskCallback, "ebus", 2000, this, 5, &ebusTask);
-
-    }
-
-    static void ebusTaskCallback(void *args)
-    {
-        auto bus = (EbusBusStream*)args;
-        bus->ebusTaskCallback();
-    }
-
-    void ebusTaskCallback();
-
-};
-
-
-void EbusBusStream::ProcessResponse(EbusMessage const &msg, EbusResponse const &response)
-{
-    for( auto monitor : monitors)
-        monitor->Notify(msg, response);
-
-    EbusBusData::ProcessResponse(msg, response);
-}
-
-
-void EbusBusStream::ebusTaskCallback()
-{
-    ESP_LOGI(TAG,"ebus starting");
-
-    for(auto dev : devices) {
-        ESP_LOGI(TAG,"starting %s", dev->GetName());
-        dev->start();
-    }
-
-//    printf("ebus printf\r\n");
-
-    EbusMessageWriter request;
-    EbusResponseWriter response;
-    
-    bool esc = false;
-    uint8_t state = 0;
-
-    EbusMessage const *cmd = nullptr;
-    int cmd_retry = 0;
-
-    while(true) {
-        int data = ReadByte();
-        if ( data >= 0)
-        {
-            uint8_t c = (uint8_t)data;
-            if (c==SYN) {
-                int oldstate = state;
-                state = 0;
-
-                if (oldstate==100){
-                    ESP_LOGI(TAG, "Failed arb %02x %02x", c, cmd->GetSource());
-                    lock_counter = lock_max;
-                    if ( cmd_retry-- == 0) {
-                        delete cmd;
-                        cmd = nullptr;
-                    }
-                }
-
-                if ( lock_counter == 0 ) {
-                    if (cmd == nullptr && !cmd_queue.empty()) {
-                        cmd = cmd_queue.front();
-                        cmd_queue.pop();
-                        cmd_retry = 3;
-                    }
-                    if (cmd != nullptr) {
-                        // send Source - arb
-                        SendChar(cmd->GetSource());
-                        //lock_counter = lock_max;
-                        state = 100;
-                    }
-                } else {
-                    lock_counter--;
-                }
-                // the master sends SYN on end of no tansactions
-                // either completion of 'timeout'
-                SynRecieved(oldstate == 98 || oldstate == 1);
-
-                switch (oldstate) {
-                    case 0:
-                        {
-                            if (!request.IsEmpty()) {
-                                printf("State:%d\r\n", oldstate);
-                                printf("e: ");
-                                request.print();
-                            }
-                        } 
-                        break;
-                    case 1:
-                        printf("No Slave Ack\r\n");
-                        break;
-                    case 2:
-                        printf("Failed response len=%d\r\n", response.GetWrittenLen());
-                        if (response.GetWrittenLen() > 0)
-                            response.print();
-                        break;
-                    case 3:
-                        printf("No Master Ack\r\n");
-                        break;
-                    case 98: // expected end
-                    case 99: // already errored
-                        break;
-                    default:
-                        printf("Unexpected state %d\r\n", oldstate);
-                        break;
-                }
-                request.Reset();
-                response.Reset();
-            } else if (c == ESC) {
-                esc = true;
-            } else {
-                if ( esc ) {
-                    if ( c == 0 )
-                        c = ESC;
-                    else if (c==1)
-                        c = SYN;
-                    esc = false;
-                }
-                switch(state)
-                {
-                    case 0:  // SS DD C1 C2 0L DD* CC
-                        {
-                        auto req = request.Write(c);
-                        if (req) {
-                            if (!request.IsValidCRC()) {
-                                printf("X:");
-                                request.print();
-                                ESP_LOGI(TAG, "bad CRC");
-                                state = 99;
-                            }
-                            else if (request.GetDest() == BROADCAST_ADDR ) {
-                                printf("B:");
-                                request.print();
-                                ProcessMessage(request);
-                                state = 98;
-                            }
-                            else {
-                                printf("r:");
-                                request.print();
-                                ProcessMessage(request);
-                                state = 1;
-                            }
-                        }
-                        }
-                        break;
-                    case 1: //  ack
-                        if (c == ACK) {
-                            if (IS_MASTER(request.GetDest())) {
-                                //printhex("m", request, req_len);
-                                state = 98;
-                            } else {
-                                state = 2;
-                            }
-                        }
-                        else if (c==NAK) {
-                            ESP_LOGI(TAG, "NAKed");
-                            err_reqnak++;
-                            state = 99;
-                        } else {
-                            ESP_LOGE(TAG, "not ack %02x", c);
-                            err_notack++;
-                            state = 99;
-                        }
-                        break;
-                    case 2: // client req
-                        {
-                        auto res = response.Write(c);
-                        if (res) {
-                            if (!response.IsValidCRC()) {
-                                ESP_LOGE(TAG, "resp bad");
-                                state = 99;
-                            } else {
-                                printf("  c:");
-                                response.print();
-                                ProcessResponse(request, response);
-                                state = 3;
-                            }
-                        }
-                        }
-                        break;
-                    case 3: // ack
-                        if (c == ACK)
-                            state = 98;
-                        else {
-                            ESP_LOGE(TAG, "Not ack for response %02x", c);
-                            state = 99;
-                        }
-                        break;
-                    case 98:
-                        ESP_LOGI(TAG, "unexpected data %02x", c);
-                        break;
-                    case 100:
-                        request.Write(c);
-                        state = 0;
-                        if (c == cmd->GetSource()) {
-                            // we won arb
-                            SendData(cmd->GetBuffer() + 1, cmd->GetBufferLength()-1);
-                            // TODO
-                            delete cmd;
-                            cmd = nullptr;
-                        } else {
-                            ESP_LOGI(TAG, "Failed arb %02x %02x", c, cmd->GetSource());
-                            lock_counter = lock_max;
-                            if ( cmd_retry-- == 0) {
-                                delete cmd;
-                                cmd = nullptr;
-                            }
-                        }
-                        break;
-                }
-
-            }
-
-            SynRetrigger();
-
-        } else if (data < -1) {
-            ESP_LOGE(TAG, "uart read failed");
-            break;
-        }
-
-    }
-}
-
-
-class EbusBusUart : public EbusBusStream
-{
-    uart_port_t uart_num;
-
-    void SendData(const uint8_t*buf, int len)
-    {
-        uart_tx_chars(uart_num, (const char*)buf, len);
-    } 
-
-    int ReadByte()
-    {
-        uint8_t c;
-        int len = uart_read_bytes(uart_num, &c, 1, 40/portTICK_PERIOD_MS);
-        if (len == 1)
-            return c;
-        if (len == 0)
-            return -1;
-        return -2; // error
-    }
-public:
-    EbusBusUart(uart_port_t port)
-    {
-        uart_num = port;
-    }
-};
-
 int buscount = 0;
 EbusBus *busses[10];
 
@@ -573,7 +231,7 @@ void start_ebus_task()
     };
     uart_intr_config(uart_num, &int_cfg);
 
-    auto uartbus = new EbusBusUart(uart_num);
+    auto uartbus = new EbusBusIsrUart(uart_num);
     EbusBus *bus = uartbus;
 
     busses[buscount++] = uartbus;
@@ -612,11 +270,13 @@ void start_ebus_task()
 //    auto vr65 = CreateVR65Device(false, 2);
 //    uartbus->AddDevice(vr65);
 
+    EbusLogStart();
     uartbus->start();
 
-    dev->AddMonitor( initialise_ebusd(dev) );
+    // ebusd wants frames in order, mqtt only the latest values
+    dev->AddMonitor( new EbusAsyncMonitor("ebusd", initialise_ebusd(dev), EbusDropPolicy::DropNewest) );
 
-    uartbus->AddMonitor( initialise_mqtt(dev));
+    uartbus->AddMonitor( new EbusAsyncMonitor("mqtt", initialise_mqtt(dev, uartbus->GetStats()), EbusDropPolicy::DropOldest) );
 
 }
 
@@ -633,6 +293,12 @@ uint8_t fromHex(const char*h)
     return (c1<<4) | c2;
 }
 
+// on the bus task, printed later by the log task
+static void ebus_data_done(EbusTransaction const &tx, void *ctx)
+{
+    EbusLogTransaction(tx);
+}
+
 int ebus_data_func(int argc, char**argv)
 {
     int nerrors = arg_parse(argc, argv, (void **) &ebus_data_args);
@@ -661,16 +327,30 @@ int ebus_data_func(int argc, char**argv)
         return 1;
     }
 
-    auto cmd = new EbusMessageWriter();
-    cmd->Write(masterAddress);
+    EbusMessageWriter writer;
+    writer.Write(masterAddress);
 
     for(int n = 0; n < l; n+=2)
     {
-        cmd->Write(fromHex(data+n));
+        writer.Write(fromHex(data+n));
     }
 
-    cmd->SetCRC();
-    bus->QueueMessage(cmd);
+    writer.SetCRC();
+
+    auto cmd = EbusMessagePtr::Create(writer);
+    if (!cmd) {
+        printf("No free message\r\n");
+        return 1;
+    }
+    auto tx = EbusTransactionPtr::Create(std::move(cmd), ebus_data_done);
+    if (!tx) {
+        printf("No free transaction\r\n");
+        return 1;
+    }
+    if (!bus->QueueTransaction(std::move(tx), EbusTxClass::Interactive)) {
+        printf("Queue full\r\n");
+        return 1;
+    }
 
     return 0;
 }
@@ -711,7 +391,217 @@ int ebus_print_func(int argc, char**argv)
     }
 
     dev->print();
+    printf("unknown commands:%u\r\n", dev->GetUnknownCommands());
+
+    return 0;
+}
+
+static void print_pool(const char *name, EbusPoolStats const &stats)
+{
+    printf("%-9s size:%d used:%d high:%d acquired:%u exhausted:%u\r\n", name,
+        stats.size, stats.inUse, stats.highWater, stats.acquired, stats.exhausted);
+}
+
+int ebus_pool_func(int argc, char**argv)
+{
+    print_pool("message", EbusPoolOf<EbusMessage>().GetStats());
+    print_pool("tx", EbusPoolOf<EbusTransaction>().GetStats());
+    for (int n = 0; n < buscount; n++)
+        busses[n]->PrintStats();
+    EbusAsyncMonitor::PrintAll();
+    printf("log dropped:%u\r\n", EbusLogDropped());
+    return 0;
+}
+
+struct
+{
+    struct arg_str *set;
+    struct arg_end *end;
+} ebus_trace_args;
+
+int ebus_trace_func(int argc, char**argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &ebus_trace_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, ebus_trace_args.end, argv[0]);
+        return 1;
+    }
+
+    if (ebus_trace_args.set->count) {
+        auto set = ebus_trace_args.set->sval[0];
+        if (!strcmp(set, "on"))
+            ebusTraceEnabled = true;
+        else if (!strcmp(set, "off"))
+            ebusTraceEnabled = false;
+        else if (!strcmp(set, "clear"))
+            EbusTraceClear();
+        else {
+            printf("Invalid setting\r\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    EbusTraceDump();
+    return 0;
+}
+
+struct
+{
+    struct arg_int *bus;
+    struct arg_str *set;
+    struct arg_end *end;
+} ebus_stats_args;
+
+int ebus_stats_func(int argc, char**argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &ebus_stats_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, ebus_stats_args.end, argv[0]);
+        return 1;
+    }
+
+    int busindex = 0;
+    if (ebus_stats_args.bus->count)
+        busindex = ebus_stats_args.bus->ival[0];
+
+    if (busindex < 0 || busindex >= buscount) {
+        printf("Invlid bus\r\n");
+        return 1;
+    }
+
+    auto stats = busses[busindex]->GetStats();
+    if (!stats) {
+        printf("No stats for bus\r\n");
+        return 1;
+    }
+
+    if (ebus_stats_args.set->count) {
+        if (strcmp(ebus_stats_args.set->sval[0], "clear")) {
+            printf("Invalid setting\r\n");
+            return 1;
+        }
+        stats->RequestClear();
+        return 0;
+    }
+
+    stats->print();
+    return 0;
+}
+
+struct
+{
+    struct arg_int *bus;
+    struct arg_str *set;
+    struct arg_end *end;
+} ebus_latency_args;
+
+int ebus_latency_func(int argc, char**argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **) &ebus_latency_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, ebus_latency_args.end, argv[0]);
+        return 1;
+    }
+
+    int busindex = 0;
+    if (ebus_latency_args.bus->count)
+        busindex = ebus_latency_args.bus->ival[0];
+
+    if (busindex < 0 || busindex >= buscount) {
+        printf("Invlid bus\r\n");
+        return 1;
+    }
+
+    auto stats = busses[busindex]->GetStats();
+    if (!stats) {
+        printf("No stats for bus\r\n");
+        return 1;
+    }
+
+    if (ebus_latency_args.set->count) {
+        if (strcmp(ebus_latency_args.set->sval[0], "clear")) {
+            printf("Invalid setting\r\n");
+            return 1;
+        }
+        stats->RequestClearLatency();
+        return 0;
+    }
 
+    stats->PrintLatency();
+    return 0;
+}
+
+// the float codecs the devices used before EbusFixed, kept for comparison
+static uint8_t FloatData1c(float f) { return (int)(f*2); }
+static uint16_t FloatData2c(float f) { return (int)(f*16); }
+static float FloatReadData1c(uint8_t c) { return c / 2.0f; }
+static float FloatReadData2c(uint16_t w) { return (int16_t)w / 16.0f; }
+
+#define EBUS_CODEC_ROUNDS 1000
+
+// cycles per value for the float and the fixed point codecs
+int ebus_codec_func(int argc, char**argv)
+{
+    volatile uint8_t byteIn = 143;
+    volatile uint16_t wordIn = 1144;
+    volatile float floatIn = 71.5f;
+    volatile int32_t fixedIn = EbusFixed::FromFloat(71.5f).Raw();
+    volatile uint32_t out;
+    volatile float floatOut;
+    uint32_t start, floatCycles, fixedCycles;
+
+    printf("codec         float   fixed  cycles/value\r\n");
+
+    start = soc_get_ccount();
+    for (int n = 0; n < EBUS_CODEC_ROUNDS; n++)
+        out = FloatData1c(floatIn);
+    floatCycles = soc_get_ccount() - start;
+    start = soc_get_ccount();
+    for (int n = 0; n < EBUS_CODEC_ROUNDS; n++)
+        out = EbusFixed::FromRaw(fixedIn).Halves();
+    fixedCycles = soc_get_ccount() - start;
+    printf("data1c enc  %7u %7u\r\n", floatCycles / EBUS_CODEC_ROUNDS, fixedCycles / EBUS_CODEC_ROUNDS);
+
+    start = soc_get_ccount();
+    for (int n = 0; n < EBUS_CODEC_ROUNDS; n++)
+        out = FloatData2c(floatIn);
+    floatCycles = soc_get_ccount() - start;
+    start = soc_get_ccount();
+    for (int n = 0; n < EBUS_CODEC_ROUNDS; n++)
+        out = EbusFixed::FromRaw(fixedIn).Sixteenths();
+    fixedCycles = soc_get_ccount() - start;
+    printf("data2c enc  %7u %7u\r\n", floatCycles / EBUS_CODEC_ROUNDS, fixedCycles / EBUS_CODEC_ROUNDS);
+
+    start = soc_get_ccount();
+    for (int n = 0; n < EBUS_CODEC_ROUNDS; n++)
+        floatOut = FloatReadData1c(byteIn);
+    floatCycles = soc_get_ccount() - start;
+    start = soc_get_ccount();
+    for (int n = 0; n < EBUS_CODEC_ROUNDS; n++)
+        out = EbusFixed::FromHalves(byteIn).Raw();
+    fixedCycles = soc_get_ccount() - start;
+    printf("data1c dec  %7u %7u\r\n", floatCycles / EBUS_CODEC_ROUNDS, fixedCycles / EBUS_CODEC_ROUNDS);
+
+    start = soc_get_ccount();
+    for (int n = 0; n < EBUS_CODEC_ROUNDS; n++)
+        floatOut = FloatReadData2c(wordIn);
+    floatCycles = soc_get_ccount() - start;
+    start = soc_get_ccount();
+    for (int n = 0; n < EBUS_CODEC_ROUNDS; n++)
+        out = EbusFixed::FromSixteenths((int16_t)wordIn).Raw();
+    fixedCycles = soc_get_ccount() - start;
+    printf("data2c dec  %7u %7u\r\n", floatCycles / EBUS_CODEC_ROUNDS, fixedCycles / EBUS_CODEC_ROUNDS);
+
+    // the old EXP was a plain copy of the float bits
+    start = soc_get_ccount();
+    for (int n = 0; n < EBUS_CODEC_ROUNDS; n++)
+        out = EbusFixed::FromRaw(fixedIn).ToExp();
+    fixedCycles = soc_get_ccount() - start;
+    printf("exp enc     %7s %7u\r\n", "-", fixedCycles / EBUS_CODEC_ROUNDS);
+
+    (void)out;
+    (void)floatOut;
     return 0;
 }
 
@@ -744,6 +634,59 @@ void register_ebus_cmds()
     };
     esp_console_cmd_register(&ebus_print_cmd);
 
+    const esp_console_cmd_t ebus_pool_cmd = {
+        .command = "ebus_pool",
+        .help = "Print Ebus frame pool, queue and monitor usage",
+        .hint = NULL,
+        .func = ebus_pool_func,
+        .argtable = NULL
+    };
+    esp_console_cmd_register(&ebus_pool_cmd);
+
+    ebus_trace_args.set = arg_str0("s","set","on|off|clear","trace setting");
+    ebus_trace_args.end = end;
+    const esp_console_cmd_t ebus_trace_cmd = {
+        .command = "ebus_trace",
+        .help = "Dump the Ebus bus task trace",
+        .hint = NULL,
+        .func = ebus_trace_func,
+        .argtable = &ebus_trace_args
+    };
+    esp_console_cmd_register(&ebus_trace_cmd);
+
+    ebus_stats_args.bus = bus;
+    ebus_stats_args.set = arg_str0("s","set","clear","clear the counters");
+    ebus_stats_args.end = end;
+    const esp_console_cmd_t ebus_stats_cmd = {
+        .command = "ebus_stats",
+        .help = "Print Ebus traffic by address and command",
+        .hint = NULL,
+        .func = ebus_stats_func,
+        .argtable = &ebus_stats_args
+    };
+    esp_console_cmd_register(&ebus_stats_cmd);
+
+    ebus_latency_args.bus = bus;
+    ebus_latency_args.set = arg_str0("s","set","clear","clear the histograms");
+    ebus_latency_args.end = end;
+    const esp_console_cmd_t ebus_latency_cmd = {
+        .command = "ebus_latency",
+        .help = "Print Ebus ACK, response and transaction latency percentiles",
+        .hint = NULL,
+        .func = ebus_latency_func,
+        .argtable = &ebus_latency_args
+    };
+    esp_console_cmd_register(&ebus_latency_cmd);
+
+    const esp_console_cmd_t ebus_codec_cmd = {
+        .command = "ebus_codec",
+        .help = "Compare float and fixed point codec cycles",
+        .hint = NULL,
+        .func = ebus_codec_func,
+        .argtable = NULL
+    };
+    esp_console_cmd_register(&ebus_codec_cmd);
+
 
     register_bai_cmds();
     register_vr65_cmds();
@@ -0,0 +1,67 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ebus_trace.h"
+
+EbusTraceEntry ebusTrace[EBUS_TRACE_SIZE];
+std::atomic<uint32_t> ebusTraceHead(0);
+bool ebusTraceEnabled = true;
+
+void EbusTraceClear()
+{
+    ebusTraceHead.store(0, std::memory_order_relaxed);
+}
+
+// cycles as microseconds with two decimals
+static void PrintUs(uint32_t cycles)
+{
+    uint32_t us100 = (uint64_t)cycles * 100 / CONFIG_ESP8266_DEFAULT_CPU_FREQ_MHZ;
+    printf(" %8u.%02u", us100 / 100, us100 % 100);
+}
+
+void EbusTraceDump()
+{
+    static const char *events[] = { "rx", "state", "tx", "dispatch", "done" };
+    // EbusRxState
+    static const char *states[] = { "request", "req-ack", "response", "resp-ack", "done", "error", "arb" };
+
+    // stop adding while the ring is read
+    bool enabled = ebusTraceEnabled;
+    ebusTraceEnabled = false;
+
+    uint32_t head = ebusTraceHead.load(std::memory_order_relaxed);
+    uint32_t count = head < EBUS_TRACE_SIZE ? head : EBUS_TRACE_SIZE;
+
+    printf("# %u events, %d MHz, %s\r\n", count, CONFIG_ESP8266_DEFAULT_CPU_FREQ_MHZ,
+        enabled ? "on" : "off");
+    printf("#      at_us    delta_us event    arg\r\n");
+
+    uint32_t first = 0, prev = 0;
+    for (uint32_t n = head - count; n != head; n++) {
+        auto &entry = ebusTrace[n & (EBUS_TRACE_SIZE - 1)];
+        if (n == head - count)
+            first = prev = entry.ccount;
+        PrintUs(entry.ccount - first);
+        PrintUs(entry.ccount - prev);
+        prev = entry.ccount;
+
+        auto event = (uint8_t)entry.event;
+        printf(" %-8s", event < sizeof(events)/sizeof(events[0]) ? events[event] : "?");
+        switch (entry.event) {
+            case EbusTraceEvent::State:
+                printf(" %s", entry.arg < sizeof(states)/sizeof(states[0]) ? states[entry.arg] : "?");
+                break;
+            case EbusTraceEvent::Tx:
+            case EbusTraceEvent::DispatchDone:
+                printf(" %02x %u", entry.arg, entry.arg2);
+                break;
+            default:
+                printf(" %02x", entry.arg);
+                break;
+        }
+        printf("\r\n");
+    }
+
+    ebusTraceEnabled = enabled;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+#include "sdkconfig.h"
+#include "driver/soc.h"
+
+// Cycle stamped trace of the bus task, cheap enough to stay in production:
+// one flag test, a cycle counter read and an 8 byte store per event. The
+// SYN timer sends too, so a slot is claimed with an atomic add before it is
+// written; the oldest entry is overwritten. Dump it with the ebus_trace
+// console command.
+
+#define EBUS_TRACE_SIZE 128
+
+enum class EbusTraceEvent : uint8_t {
+    Rx,             // arg = byte
+    State,          // arg = EbusRxState
+    Tx,             // arg = first byte, arg2 = length
+    Dispatch,       // arg = device address
+    DispatchDone,   // arg = device address, arg2 = 1 when ACKed
+};
+
+struct EbusTraceEntry
+{
+    uint32_t ccount;
+    EbusTraceEvent event;
+    uint8_t arg;
+    uint16_t arg2;
+};
+
+extern EbusTraceEntry ebusTrace[EBUS_TRACE_SIZE];
+extern std::atomic<uint32_t> ebusTraceHead;
+extern bool ebusTraceEnabled;
+
+static inline void EbusTrace(EbusTraceEvent event, uint8_t arg, uint16_t arg2 = 0)
+{
+    if (!ebusTraceEnabled)
+        return;
+    auto slot = ebusTraceHead.fetch_add(1, std::memory_order_relaxed);
+    auto &entry = ebusTrace[slot & (EBUS_TRACE_SIZE - 1)];
+    entry.ccount = soc_get_ccount();
+    entry.event = event;
+    entry.arg = arg;
+    entry.arg2 = arg2;
+}
+
+void EbusTraceClear();
+void EbusTraceDump();
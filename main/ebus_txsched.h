@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stdio.h>
+#include <atomic>
+
+#include "esp_timer.h"
+
+#include "ebus_ring.h"
+
+#define EBUS_TX_RING_SIZE 8
+// a waiting frame moves up one class per step
+#define EBUS_TX_AGE_US 500000
+
+// Transmit queue for a bus: one ring per class, each with its own limit so
+// a burst in one class can't push out the others. The bus task takes the
+// head with the best rank, where rank is the class minus the steps its head
+// has waited, so polls and broadcasts are never starved. On equal rank the
+// frame whose source has the lower eBUS priority nibble goes first. That is
+// the only say the nibble has: each frame arbitrates with its own source,
+// never another of our master addresses, as answers find their device by
+// the source.
+class EbusTxScheduler
+{
+    struct Stats
+    {
+        std::atomic<uint32_t> queued;
+        std::atomic<uint32_t> dropped;
+        uint32_t sent;
+        uint32_t aged;
+    };
+
+    EbusMpscRing<EbusTransaction*, EBUS_TX_RING_SIZE> rings[EBUS_TX_CLASSES];
+    Stats stats[EBUS_TX_CLASSES];
+
+    static uint8_t Limit(int cls)
+    {
+        static const uint8_t limits[EBUS_TX_CLASSES] = { 4, 4, 8, 4 };
+        return limits[cls];
+    }
+
+public:
+    EbusTxScheduler()
+    {
+        for (auto &s : stats) {
+            s.queued.store(0, std::memory_order_relaxed);
+            s.dropped.store(0, std::memory_order_relaxed);
+            s.sent = 0;
+            s.aged = 0;
+        }
+    }
+
+    // any task, tx is left with the caller when the class is full
+    bool Push(EbusTransactionPtr &tx, EbusTxClass cls)
+    {
+        int c = (int)cls;
+        tx->queuedAt = esp_timer_get_time();
+        if (rings[c].Size() >= Limit(c) || !rings[c].Push(tx.get())) {
+            stats[c].dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        tx.release();
+        stats[c].queued.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // bus task only
+    EbusTransactionPtr Pop()
+    {
+        int64_t now = esp_timer_get_time();
+        int best = -1;
+        int bestRank = 0;
+        uint8_t bestPri = 0;
+        for (int c = 0; c < EBUS_TX_CLASSES; c++) {
+            EbusTransaction *tx;
+            if (!rings[c].Peek(tx))
+                continue;
+            int64_t steps = (now - tx->queuedAt) / EBUS_TX_AGE_US;
+            int rank = steps >= c ? 0 : c - (int)steps;
+            uint8_t pri = tx->msg->GetSource() & 0x0f;
+            if (best < 0 || rank < bestRank || (rank == bestRank && pri < bestPri)) {
+                best = c;
+                bestRank = rank;
+                bestPri = pri;
+            }
+        }
+        if (best < 0)
+            return EbusTransactionPtr();
+
+        EbusTransaction *tx;
+        rings[best].Pop(tx);
+        stats[best].sent++;
+        if (bestRank < best)
+            stats[best].aged++;
+        return EbusTransactionPtr::Adopt(tx);
+    }
+
+    void print()
+    {
+        static const char *names[EBUS_TX_CLASSES] = { "interactive", "control", "poll", "broadcast" };
+        for (int c = 0; c < EBUS_TX_CLASSES; c++) {
+            printf("tx %-11s used:%d/%d queued:%u dropped:%u sent:%u aged:%u\r\n", names[c],
+                (int)rings[c].Size(), Limit(c),
+                stats[c].queued.load(std::memory_order_relaxed),
+                stats[c].dropped.load(std::memory_order_relaxed),
+                stats[c].sent, stats[c].aged);
+        }
+    }
+};
@@ -0,0 +1,206 @@
+#include <stdint.h>
+#include <stdio.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/uart.h"
+#include "esp8266/uart_struct.h"
+#include "esp8266/uart_register.h"
+
+#include "ebus.h"
+#include "ebus_dev.h"
+#include "ebus_uart.h"
+
+uint8_t EbusBusIsrUart::crcTable[256];
+
+EbusBusIsrUart::EbusBusIsrUart(uart_port_t port)
+{
+    for (int n = 0; n < 256; n++)
+        crcTable[n] = crc8v_update(n, 0);
+
+    uart_num = port;
+    dev = port == UART_NUM_0 ? &uart0 : &uart1;
+    uart_isr_register(uart_num, Isr, this);
+    uart_enable_rx_intr(uart_num);
+}
+
+void IRAM_ATTR EbusBusIsrUart::Isr(void *arg)
+{
+    auto bus = (EbusBusIsrUart*)arg;
+    auto dev = bus->dev;
+    uint32_t status = dev->int_st.val;
+
+    int count = dev->status.rxfifo_cnt;
+    while (count--) {
+        uint8_t c = dev->fifo.rw_byte;
+
+        if (bus->txWaiting) {
+            bus->txWaiting = false;
+            if (c != bus->txData[bus->txPos - 1]) {
+                // collided, not a byte more
+                bus->txLen = 0;
+                bus->txStopped++;
+            } else if (bus->txPos < bus->txLen) {
+                dev->fifo.rw_byte = bus->txData[bus->txPos++];
+                bus->txWaiting = true;
+            }
+        }
+
+        if (bus->sent) {
+            // the first byte after our source decides it
+            bus->sent = false;
+            if (c == bus->source)
+                bus->won++;
+            else
+                bus->lost++;
+        }
+
+        uint32_t head = bus->rxHead;
+        if (head - bus->rxTail == EBUS_UART_RX_SIZE) {
+            bus->rxOverflow++;
+            bus->frameTrack = false;
+            continue;
+        }
+        bus->rx[head % EBUS_UART_RX_SIZE] = c;
+        bus->rxHead = head + 1;
+
+        bool last = count == 0 && dev->status.rxfifo_cnt == 0;
+        if (c != SYN) {
+            if (bus->frameTrack)
+                bus->TrackRequest(c, last);
+            continue;
+        }
+
+        bus->framePos = 0;
+        bus->frameCrc = 0;
+        bus->frameEsc = false;
+        bus->frame[5] = 0;
+        bus->frameTrack = true;
+
+        // only a SYN with nothing behind it, otherwise someone already started
+        bus->isrSyn++;
+        if (bus->armed && last) {
+            dev->fifo.rw_byte = bus->source;
+            bus->armed = false;
+            bus->sent = true;
+            bus->sentSyn = bus->isrSyn;
+            bus->fired++;
+        }
+    }
+    dev->int_clr.val = status;
+
+    if (bus->rxTask) {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(bus->rxTask, &woken);
+        if (woken)
+            portYIELD_FROM_ISR();
+    }
+}
+
+// Follows a request to one of our devices and, when its CRC is good and a
+// template matches, sends the ACK and response right away. Raw bytes go
+// into the CRC, which is the same as crc8v_update on the unescaped ones.
+void IRAM_ATTR EbusBusIsrUart::TrackRequest(uint8_t c, bool last)
+{
+    bool isCrc = framePos >= 5 && framePos == 5 + frame[4];
+    if (!isCrc)
+        frameCrc = crcTable[frameCrc] ^ c;
+
+    if (frameEsc) {
+        c = c == 0 ? ESC : c == 1 ? SYN : c;
+        frameEsc = false;
+    } else if (c == ESC) {
+        frameEsc = true;
+        return;
+    }
+
+    if (isCrc) {
+        frameTrack = false;
+        if (c != frameCrc || !last)
+            return;
+        auto tmpl = frameDevice->FindTemplate((frame[2] << 8) | frame[3], frame[4], frame[5]);
+        if (!tmpl)
+            return;
+        auto wire = tmpl->GetWire();
+        for (int n = 0; n < tmpl->len; n++)
+            dev->fifo.rw_byte = wire[n];
+        answeredSyn = isrSyn;
+        answeredSet = true;
+        answered++;
+        return;
+    }
+
+    if (framePos < sizeof(frame))
+        frame[framePos] = c;
+    if (framePos == 1) {
+        // our slaves only, masters just get an ACK
+        frameDevice = deviceMap[c];
+        if (!frameDevice || frameDevice->GetSlaveAddress() != c) {
+            frameTrack = false;
+            return;
+        }
+    }
+    if (framePos == 4 && c > EBUS_MAX_PAYLOAD) {
+        frameTrack = false;
+        return;
+    }
+    framePos++;
+}
+
+int EbusBusIsrUart::ReadBytes(uint8_t *buf, int len)
+{
+    if (!rxTask)
+        rxTask = xTaskGetCurrentTaskHandle();
+
+    if (rxTail == rxHead)
+        ulTaskNotifyTake(pdTRUE, 10/portTICK_PERIOD_MS);
+
+    int n = 0;
+    uint32_t head = rxHead;
+    while (n < len && rxTail != head)
+        buf[n++] = rx[rxTail++ % EBUS_UART_RX_SIZE];
+    return n;
+}
+
+bool EbusBusIsrUart::ArmArbitration(uint8_t addr)
+{
+    // source before armed, the interrupt may come in between
+    source = addr;
+    armed = true;
+    return true;
+}
+
+bool EbusBusIsrUart::SynArbitrated()
+{
+    return ++taskSyn == sentSyn;
+}
+
+bool EbusBusIsrUart::SendEchoed(const uint8_t *data, int from, int len)
+{
+    portENTER_CRITICAL();
+    // more for the frame in flight carries on from where it is
+    if (data != txData || !txWaiting) {
+        txData = data;
+        txPos = from;
+    }
+    txLen = len;
+    if (!txWaiting && txPos < txLen) {
+        dev->fifo.rw_byte = txData[txPos++];
+        txWaiting = true;
+    }
+    portEXIT_CRITICAL();
+    return true;
+}
+
+bool EbusBusIsrUart::RequestAnswered()
+{
+    // both counts start at 0, a request before the first SYN was not answered
+    return answeredSet && answeredSyn == taskSyn;
+}
+
+void EbusBusIsrUart::PrintStats()
+{
+    EbusBusStream::PrintStats();
+    printf("isr arb fired:%u won:%u lost:%u armed:%d answered:%u tx stopped:%u rx overflow:%u\r\n",
+        fired, won, lost, armed, answered, txStopped, rxOverflow);
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "driver/uart.h"
+#include "esp8266/uart_struct.h"
+
+#include "ebus_stream.h"
+
+#define EBUS_UART_RX_SIZE 256
+
+// Bus on a hardware uart with its own receive interrupt in place of the
+// driver's. The interrupt queues bytes for the bus task and does the
+// things that can't wait for the task: putting our source address on the
+// wire straight after SYN, answering requests to our devices from their
+// templates straight after the CRC, and sending our frames a byte per
+// echo. The driver stays installed for sending.
+class EbusBusIsrUart : public EbusBusStream
+{
+    uart_port_t uart_num;
+    uart_dev_t *dev;
+    TaskHandle_t rxTask = nullptr;
+
+    // written by the interrupt, read by the bus task
+    uint8_t rx[EBUS_UART_RX_SIZE];
+    volatile uint32_t rxHead = 0;
+    uint32_t rxTail = 0;
+    volatile uint32_t rxOverflow = 0;
+
+    // arbiter, armed by the bus task and fired by the interrupt
+    volatile bool armed = false;
+    volatile bool sent = false;         // waiting for the echo
+    volatile uint8_t source;
+    volatile uint32_t isrSyn = 0;       // SYNs queued
+    volatile uint32_t sentSyn = 0;      // the SYN the source followed
+    uint32_t taskSyn = 0;               // SYNs taken by the parser
+
+    volatile uint32_t fired = 0;
+    volatile uint32_t won = 0;
+    volatile uint32_t lost = 0;
+
+    // frame sent from the interrupt, the next byte when the echo matched
+    const uint8_t *volatile txData = nullptr;
+    volatile uint8_t txLen = 0;
+    volatile uint8_t txPos = 0;         // next to send
+    volatile bool txWaiting = false;    // a byte is out, echo not back
+    volatile uint32_t txStopped = 0;
+
+    // request since the last SYN, followed by the interrupt
+    uint8_t frame[6];                   // QQ ZZ PB SB NN and the first data byte
+    uint8_t framePos = 0;
+    uint8_t frameCrc = 0;
+    bool frameEsc = false;
+    bool frameTrack = false;
+    EbusDevice *frameDevice = nullptr;
+    volatile uint32_t answeredSyn = 0;  // the SYN before the request answered
+    volatile bool answeredSet = false;  // answeredSyn means nothing before the first
+    volatile uint32_t answered = 0;
+
+    // the crc table in RAM, the interrupt can't rely on flash
+    static uint8_t crcTable[256];
+
+    static void Isr(void *arg);
+    void TrackRequest(uint8_t c, bool last);
+
+    void SendData(const uint8_t *buf, int len)
+    {
+        EbusTrace(EbusTraceEvent::Tx, buf[0], len);
+        uart_tx_chars(uart_num, (const char*)buf, len);
+    }
+
+    int ReadBytes(uint8_t *buf, int len);
+    bool ArmArbitration(uint8_t source);
+    bool SynArbitrated();
+    bool RequestAnswered();
+    bool SendEchoed(const uint8_t *data, int from, int len);
+
+public:
+    // after uart_driver_install, takes the receive interrupt over
+    EbusBusIsrUart(uart_port_t port);
+
+    void PrintStats();
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdint.h>
+#include <math.h>
+
+// Fixed point value in 1/256 steps, exact for every eBUS number type:
+// DATA1c counts halves, DATA2c sixteenths and DATA2b 1/256. The ESP8266
+// has no FPU, so devices keep their state in this and only the edges
+// (console, MQTT, printing) convert to float.
+class EbusFixed
+{
+    int32_t raw;
+
+    constexpr EbusFixed(int32_t r, bool) : raw(r) {}
+
+public:
+    // the replacement value on the bus, NaN as a float
+    static const int32_t INVALID = INT32_MIN;
+
+    constexpr EbusFixed() : raw(INVALID) {}
+
+    static constexpr EbusFixed FromRaw(int32_t r) { return EbusFixed(r, true); }
+    static constexpr EbusFixed FromInt(int32_t v) { return EbusFixed(v * 256, true); }
+    static constexpr EbusFixed FromHalves(int32_t v) { return EbusFixed(v * 128, true); }
+    static constexpr EbusFixed FromSixteenths(int32_t v) { return EbusFixed(v * 16, true); }
+    // for constants, which the compiler folds, and the console
+    static constexpr EbusFixed FromFloat(float f) { return EbusFixed(f != f ? INVALID : (int32_t)(f * 256), true); }
+
+    constexpr bool IsValid() const { return raw != INVALID; }
+    constexpr int32_t Raw() const { return raw; }
+
+    // all truncated towards zero, like the float casts they replace
+    constexpr int32_t ToInt() const { return raw / 256; }
+    constexpr int32_t Halves() const { return raw / 128; }
+    constexpr int32_t Sixteenths() const { return raw / 16; }
+    // the value times factor, as an integer
+    constexpr int32_t Scaled(int32_t factor) const { return raw * factor / 256; }
+
+    float ToFloat() const { return IsValid() ? raw / 256.0f : NAN; }
+
+    constexpr EbusFixed operator+(EbusFixed other) const
+    {
+        return EbusFixed(IsValid() && other.IsValid() ? raw + other.raw : INVALID, true);
+    }
+    constexpr bool operator==(EbusFixed other) const { return raw == other.raw; }
+    constexpr bool operator!=(EbusFixed other) const { return raw != other.raw; }
+
+    // IEEE 754 single precision bits (EXP), with integer operations only
+    uint32_t ToExp() const
+    {
+        if (!IsValid())
+            return 0x7fffffff;
+        if (raw == 0)
+            return 0;
+        uint32_t sign = raw < 0 ? 0x80000000 : 0;
+        uint32_t mag = raw < 0 ? -(uint32_t)raw : (uint32_t)raw;
+        int top = 31 - __builtin_clz(mag);
+        uint32_t mant = top > 23 ? mag >> (top - 23) : mag << (23 - top);
+        // mag is the value times 2^8
+        return sign | ((uint32_t)(top - 8 + 127) << 23) | (mant & 0x7fffff);
+    }
+
+    static EbusFixed FromExp(uint32_t bits)
+    {
+        int exp = (bits >> 23) & 0xff;
+        if (exp == 0xff)
+            return EbusFixed();
+        // zero, and denormals are below 1/256 anyway
+        if (exp == 0)
+            return FromRaw(0);
+        uint32_t mant = (bits & 0x7fffff) | 0x800000;
+        // the value is mant * 2^(exp - 150), raw is that times 2^8
+        int shift = exp - 142;
+        uint32_t mag;
+        if (shift > 7)
+            return EbusFixed();
+        else if (shift >= 0)
+            mag = mant << shift;
+        else if (shift > -32)
+            mag = mant >> -shift;
+        else
+            mag = 0;
+        return FromRaw(bits & 0x80000000 ? -(int32_t)mag : (int32_t)mag);
+    }
+};
+
+// packed BCD without a division, the ESP8266 has no divide instruction
+static inline uint8_t EbusToBCD(uint8_t c)
+{
+    // c * 205 >> 11 is c / 10 for every c below 1029
+    uint8_t tens = (c * 205) >> 11;
+    return (tens << 4) | (c - tens * 10);
+}
+
+static inline int EbusFromBCD(uint8_t c)
+{
+    return 10 * (c >> 4) + (c & 0xf);
+}
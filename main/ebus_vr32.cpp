@@ -1,5 +1,6 @@
 
 #include <stdint.h>
+#include <stdio.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/timers.h"
@@ -8,6 +9,7 @@
 
 #include "ebus_dev.h"
 #include "ebus_device.h"
+#include "ebus_log.h"
 
 #include "esp_log.h"
 
@@ -34,67 +36,75 @@ public:
       : EbusDeviceBridgeBase(addr, 0xb5, "V32  ", 0x117, 0x9802 ,b)
     {}
 
-    bool ProcessSlaveMessage(EbusMessage const &msg, EbusResponse **response)
+private:
+    bool Proxy(EbusMessage const &msg, EbusResponse &response)
     {
-        auto cmd = msg.GetCmd();
-        switch (cmd) {
-            case 0xb517:
-            {
-                EbusMessageWriter prxMsg;
-                prxMsg.Write(masterAddress);
-                auto m = msg.GetPayloadLength();
-                auto p = msg.GetPayload();
-                for(int n = 0; n < m; n++)
-                    prxMsg.Write(p[n]);
-                prxMsg.SetCRC();
-                //printf("prox req:");
-                prxMsg.print();
-                ACKed = false;
-                prxResponse.Reset();
-                ProcessDeviceMessage(prxMsg);
-                if (!prxResponse.IsEmpty()) {
-                    auto prxMsg = new EbusMessage(masterAddress, msg.GetSource(), 0xb518);
-                    auto m = prxResponse.GetPayloadLength();
-        //ESP_LOGI(name, "sending response len %d", m);
-                    for( int n = 0; n < m; n++)
-                        prxMsg->AddPayload(prxResponse.GetPayload()[n]);
-                    prxMsg->SetCRC();
-                    //printf("queued response: ");
-                    prxMsg->print();
-                    bus->QueueMessage(prxMsg);
-                }
-
-                return ACKed;
-            }
-            case 0xb510: // write state
-            case 0xb511: // read state
-            case 0xb512: // read
-            case 0xb513: // ?
-            case 0xb516: // ?
-            { 
-                EbusMessageWriter prxMsg;
-                prxMsg.Write(masterAddress);
-                prxMsg.Write(0x08);
-                prxMsg.Write(cmd>>8);
-                prxMsg.Write(cmd & 0xff);
-                auto m = msg.GetPayloadLength();
-                prxMsg.Write(m);
-                for(int n = 0; n < m; n++)
-                    prxMsg.Write(msg.GetPayload()[n]);
-                prxMsg.SetCRC();
-                //printf("prox req:");
-                //prxMsg.print();
-                ACKed = false;
-                prxResponse.Reset();
-                ProcessDeviceMessage(prxMsg);
-                if (ACKed && !prxResponse.IsEmpty()) {
-                    auto res = new EbusResponse(prxResponse);
-                    *response = res;
-                }
-                return ACKed;
-            }
-            break;
+        EbusMessageWriter prxMsg;
+        prxMsg.Write(masterAddress);
+        auto m = msg.GetPayloadLength();
+        auto p = msg.GetPayload();
+        for(int n = 0; n < m; n++)
+            prxMsg.Write(p[n]);
+        prxMsg.SetCRC();
+        EbusLogFrame(EbusLogEvent::ProxyRequest, prxMsg.GetBuffer(), prxMsg.GetBufferLength());
+        ACKed = false;
+        prxResponse.Reset();
+        ProcessDeviceMessage(prxMsg);
+        if (!prxResponse.IsEmpty()) {
+            auto prxMsg = EbusMessagePtr::Create(masterAddress, msg.GetSource(), 0xb518);
+            if (!prxMsg)
+                return false;
+            auto m = prxResponse.GetPayloadLength();
+//ESP_LOGI(name, "sending response len %d", m);
+            for( int n = 0; n < m; n++)
+                prxMsg->AddPayload(prxResponse.GetPayload()[n]);
+            prxMsg->SetCRC();
+            EbusLogFrame(EbusLogEvent::ProxyQueued, prxMsg->GetBuffer(), prxMsg->GetBufferLength());
+            bus->QueueMessage(std::move(prxMsg), EbusTxClass::Control);
         }
+
+        return ACKed;
+    }
+
+    bool Forward(EbusMessage const &msg, EbusResponse &response)
+    {
+        auto cmd = msg.GetCmd();
+        EbusMessageWriter prxMsg;
+        prxMsg.Write(masterAddress);
+        prxMsg.Write(0x08);
+        prxMsg.Write(cmd>>8);
+        prxMsg.Write(cmd & 0xff);
+        auto m = msg.GetPayloadLength();
+        prxMsg.Write(m);
+        for(int n = 0; n < m; n++)
+            prxMsg.Write(msg.GetPayload()[n]);
+        prxMsg.SetCRC();
+        //printf("prox req:");
+        //prxMsg.print();
+        ACKed = false;
+        prxResponse.Reset();
+        ProcessDeviceMessage(prxMsg);
+        if (ACKed && !prxResponse.IsEmpty())
+            response = prxResponse;
+        return ACKed;
+    }
+
+    static constexpr EbusCommand<EbusDeviceBridge> commands[] = {
+        { 0xb517, EBUS_COMMAND_ANY_LEN, EBUS_COMMAND_ANY, &EbusDeviceBridge::Proxy },
+        { 0xb510, EBUS_COMMAND_ANY_LEN, EBUS_COMMAND_ANY, &EbusDeviceBridge::Forward }, // write state
+        { 0xb511, EBUS_COMMAND_ANY_LEN, EBUS_COMMAND_ANY, &EbusDeviceBridge::Forward }, // read state
+        { 0xb512, EBUS_COMMAND_ANY_LEN, EBUS_COMMAND_ANY, &EbusDeviceBridge::Forward }, // read
+        { 0xb513, EBUS_COMMAND_ANY_LEN, EBUS_COMMAND_ANY, &EbusDeviceBridge::Forward }, // ?
+        { 0xb516, EBUS_COMMAND_ANY_LEN, EBUS_COMMAND_ANY, &EbusDeviceBridge::Forward }, // ?
+    };
+    static constexpr auto dispatch = EbusMakeCommandTable(commands);
+
+public:
+    bool ProcessSlaveMessage(EbusMessage const &msg, EbusResponse &response)
+    {
+        bool handled;
+        if (dispatch.Dispatch(this, msg, response, handled))
+            return handled;
         return EbusDeviceBase::ProcessSlaveMessage(msg, response);
     }
 
@@ -104,11 +114,11 @@ public:
     }
 
 
-    void QueueMessage(EbusMessage const *msg)
+    // nothing is sent from this side, frames are only shown
+    bool QueueTransaction(EbusTransactionPtr tx, EbusTxClass cls)
     {
-        printf("proxy queue:");
-        msg->print();
-        delete msg;
+        EbusLogFrame(EbusLogEvent::ProxyQueued, tx->msg->GetBuffer(), tx->msg->GetBufferLength());
+        return false;
     }
 
     void start()
@@ -123,6 +133,9 @@ public:
 
 };
 
+constexpr EbusCommand<EbusDeviceBridge> EbusDeviceBridge::commands[];
+constexpr decltype(EbusDeviceBridge::dispatch) EbusDeviceBridge::dispatch;
+
 // 1-based
 static const uint8_t VR32_addr[] = {0,0x13,0x33,0x73,0xf3, 
     0x1f, 0x3f, 0x7f};
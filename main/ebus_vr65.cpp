@@ -7,10 +7,13 @@
 
 #include "ebus_dev.h"
 #include "ebus_device.h"
+#include "ebus_schema.h"
 
 #include "esp_log.h"
 #include "argtable3/argtable3.h"
 #include "esp_console.h"
+// b512 02: state, cylinder, ntc, unknown
+typedef EbusSchema<EbusByte, EbusByte, EbusData2c, EbusWord> Vr65Config;
 
 class EbusDeviceVr65 : public EbusDeviceBase1
 {
@@ -18,7 +21,7 @@ class EbusDeviceVr65 : public EbusDeviceBase1
     uint8_t sel;
     bool cyl;
     bool ntc_en;
-    float ntc;
+    EbusFixed ntc;
 public:
 
     EbusDeviceVr65(bool isVr66, uint8_t s)
@@ -28,42 +31,36 @@ public:
         state = 0;
         cyl = false;
         ntc_en = false;
-        ntc = 0;
+        ntc = EbusFixed::FromInt(0);
     }
 
-    bool ProcessSlaveMessage(EbusMessage const &msg, EbusResponse **response)
+private:
+    bool SetConfig(EbusMessage const &msg, EbusResponse &response)
     {
-        auto cmd = msg.GetCmd();
-        auto data = msg.GetPayload();
-        uint8_t p = *data;
-        switch (cmd) {
-            case 0xb512:
-                if (p == 2) {
-                    if (msg.GetPayloadLength() == 2) {
-                        // 0 off, 50= 100= 0xfe=
-                        state = data[1];
-                        ESP_LOGI(name, "Set Config %02x", state);
-                        // response 6 bytes
-                        *response = new EbusResponse();
-                        (*response)->AddPayload(state);
-                        (*response)->AddPayload(cyl);
-                        if ( ntc_en)
-                            (*response)->AddPayloadData2c(ntc);
-                        else
-                            (*response)->AddPayloadWord(0x8000);
-                        (*response)->AddPayloadWord(0xffff);
-                        return true;
-                    }
-
-                }
-                break;
-        }
+        // 0 off, 50= 100= 0xfe=
+        state = msg.GetPayload()[1];
+        ESP_LOGI(name, "Set Config %02x", state);
+        // response 6 bytes, no ntc goes as the replacement value
+        return Vr65Config::Encode(response, state, cyl, ntc_en ? ntc : EbusFixed(), 0xffff);
+    }
+
+    static constexpr EbusCommand<EbusDeviceVr65> commands[] = {
+        { 0xb512, 2, 2, &EbusDeviceVr65::SetConfig },
+    };
+    static constexpr auto dispatch = EbusMakeCommandTable(commands);
+
+public:
+    bool ProcessSlaveMessage(EbusMessage const &msg, EbusResponse &response)
+    {
+        bool handled;
+        if (dispatch.Dispatch(this, msg, response, handled))
+            return handled;
         return EbusDeviceBase1::ProcessSlaveMessage(msg, response);
     }
 
     void print()
     {
-        printf("VR65(%d) State: %02x c=%d ntc=%d\r\n", sel, state, cyl, (int)ntc);
+        printf("VR65(%d) State: %02x c=%d ntc=%d\r\n", sel, state, cyl, ntc.ToInt());
     }
 
     void SetCyl(bool f)
@@ -71,13 +68,16 @@ public:
         cyl = f;
     }
 
-    void SetNTC(float f)
+    void SetNTC(EbusFixed f)
     {
         ntc_en = true;
         ntc = f;
     }
 };
 
+constexpr EbusCommand<EbusDeviceVr65> EbusDeviceVr65::commands[];
+constexpr decltype(EbusDeviceVr65::dispatch) EbusDeviceVr65::dispatch;
+
 EbusDeviceVr65 *vr65 = nullptr;
 
 EbusDevice *CreateVR65Device(bool isVr66, uint8_t sw)
@@ -115,7 +115,7 @@ int sensor_vr65_func(int argc, char**argv)
         vr65->SetCyl(vr65_sensor_args.cyl->ival[0]);
 
     if (vr65_sensor_args.ntc->count)
-        vr65->SetNTC(vr65_sensor_args.ntc->dval[0]);
+        vr65->SetNTC(EbusFixed::FromFloat(vr65_sensor_args.ntc->dval[0]));
 
     return 0;
 }
@@ -7,11 +7,21 @@
 
 #include "ebus_dev.h"
 #include "ebus_device.h"
+#include "ebus_schema.h"
 
 #include "esp_log.h"
 #include "argtable3/argtable3.h"
 #include "esp_console.h"
 
+// b523 02: id, mixer, active, desired
+typedef EbusSchema<EbusByte, EbusByte, EbusByte, EbusData1c> Vr70SetMixer;
+typedef EbusSchema<EbusByte, EbusByte> Vr70MixerAck;
+// b523 03: six sensors, s7 in?, two unknown
+typedef EbusSchema<EbusData2c, EbusData2c, EbusData2c, EbusData2c, EbusData2c, EbusData2c,
+    EbusByte, EbusByte, EbusByte> Vr70Sensors;
+// b503 probe and b516 11, the answers never change
+static constexpr EbusConstFrame vr70ProbeAck = EbusMakeResponse(1);
+static constexpr EbusConstFrame vr70Unknown16 = EbusMakeResponse(0);
 
 class EbusDeviceVr70 : public EbusDeviceBase1
 {
@@ -21,7 +31,7 @@ protected:
 
     struct {
         enum SensorMode mode;
-        float value;
+        EbusFixed value;
     } sensors[6];
 
     uint8_t s7Out;
@@ -29,7 +39,7 @@ protected:
     struct {
         bool enabled;
         bool active;
-        float desired;
+        EbusFixed desired;
         uint8_t pos;
     } mixers[2];
 
@@ -40,90 +50,100 @@ public:
     {
         int n;
         for(n=0;n<5;n++) relay[n] = false;
-        for(n=0;n<6;n++) { sensors[n].mode = Sensor_VR10; sensors[n].value = (n+1)*10; }
+        for(n=0;n<6;n++) { sensors[n].mode = Sensor_VR10; sensors[n].value = EbusFixed::FromInt((n+1)*10); }
         for(n=0; n<2; n++) { mixers[n].enabled = false; mixers[n].pos = 30 + n*10; }
         s7Out = 0;
+
+        PublishTemplate(0xb516, 1, 0x11, vr70Unknown16);
+    }
+
+protected:
+    //  10 52 b503 (12) Data: 07 00 ff ff ff ff ff ff ff ff ff ff 
+    bool Probe(EbusMessage const &msg, EbusResponse &response)
+    {
+        ESP_LOGI(name, "probe");
+        response = EbusResponse(vr70ProbeAck);
+        return true;
+    }
+
+    //  10 52 b523 (9) Data: 00 00 01 00 02 02 00 00 00 (43)
+    bool SetConfig(EbusMessage const &msg, EbusResponse &response)
+    {
+        ESP_LOGI(name,"Set config");
+        auto data = msg.GetPayload();
+        mixers[0].enabled = !!data[1];
+        mixers[1].enabled = !!data[2];
+        for(int n = 0; n < 6; n++) {
+            sensors[n].mode = (enum SensorMode)data[3+n];
+        }
+        response.AddPayload(1);
+        return true;
     }
 
-    bool ProcessSlaveMessage(EbusMessage const &msg, EbusResponse **response)
+    bool SetActorState(EbusMessage const &msg, EbusResponse &response)
     {
-        auto cmd = msg.GetCmd();
+        ESP_LOGI(name,"Set Actor");
         auto data = msg.GetPayload();
-        uint8_t p = *data;
-        switch (cmd) {
-            case 0xb503://  10 52 b503 (12) Data: 07 00 ff ff ff ff ff ff ff ff ff ff 
-                ESP_LOGI(name, "probe");
-                *response = new EbusResponse();
-                (*response)->AddPayload(1);
-                return true;
-                //break;
-            case 0xb523:
-                switch(p) {
-                    case 0: //  10 52 b523 (9) Data: 00 00 01 00 02 02 00 00 00 (43)
-                        ESP_LOGI(name,"Set config");
-                        if (msg.GetPayloadLength() == 9) {
-                            mixers[0].enabled = !!data[1];
-                            mixers[1].enabled = !!data[2];
-                            for(int n = 0; n < 6; n++) {
-                                sensors[n].mode = (enum SensorMode)data[3+n];
-                            }
-                            *response = new EbusResponse();
-                            (*response)->AddPayload(1);
-                            return true;
-                        }
-                        break;
-                    case 1: // SetActorState
-                        ESP_LOGI(name,"Set Actor");
-                        if (msg.GetPayloadLength() == 8) {
-                            for (int n = 0; n<6; n++) {
-                                auto c = data[1+n];
-                                if (c != 0xff) {
-                                    // normally 20d, but test-actuator 0xfe
-                                    relay[n] = !!c;
-                                }
-                            }
-                            // 1 byte for s7/PWM?
-                            if (data[7] != 0xff) {
-                                s7Out = data[7];
-                            }
-                            *response = new EbusResponse();
-                            (*response)->AddPayload(1);
-                            return true;
-                        }
-                        break;
-                    case 2: // desiered temp
-                        ESP_LOGI(name,"set mix");
-                        if (msg.GetPayloadLength() == 4) {
-                            uint8_t index = data[1];
-                            if (index < 2) {
-                                mixers[index].active = !!data[2];
-                                mixers[index].desired = msg.ReadPayloadData1c(3);
-                                *response = new EbusResponse();
-                                (*response)->AddPayload(1);
-                                (*response)->AddPayload(mixers[index].pos);
-                                return true;
-                            }
-                        }
-                        break;
-                    case 3: // read sensor 
-                        *response = new EbusResponse();
-                        for(auto n = 0; n < 6; n++)
-                            (*response)->AddPayloadData2c( sensors[n].value);
-                        (*response)->AddPayload(0); // s7 in?
-                        (*response)->AddPayload(0);
-                        (*response)->AddPayload(0);
-                        return true;
-                }
-                break;
-            case 0xb516: // unknown - simple return
-                // 10 ?
-                if ( p == 0x11) { // read 8 bytes
-                    *response = new EbusResponse();
-                    (*response)->AddPayload(0);
-                    return true;
-                }
-                break;
+        for (int n = 0; n<6; n++) {
+            auto c = data[1+n];
+            if (c != 0xff) {
+                // normally 20d, but test-actuator 0xfe
+                relay[n] = !!c;
+            }
+        }
+        // 1 byte for s7/PWM?
+        if (data[7] != 0xff) {
+            s7Out = data[7];
+        }
+        response.AddPayload(1);
+        return true;
+    }
+
+    // desiered temp
+    bool SetMixer(EbusMessage const &msg, EbusResponse &response)
+    {
+        ESP_LOGI(name,"set mix");
+        uint8_t id, index, active;
+        EbusFixed desired;
+        if (!Vr70SetMixer::Decode(msg, id, index, active, desired))
+            return false;
+        if (index < 2) {
+            mixers[index].active = !!active;
+            mixers[index].desired = desired;
+            return Vr70MixerAck::Encode(response, 1, mixers[index].pos);
         }
+        return false;
+    }
+
+    bool ReadSensors(EbusMessage const &msg, EbusResponse &response)
+    {
+        return Vr70Sensors::Encode(response, sensors[0].value, sensors[1].value,
+            sensors[2].value, sensors[3].value, sensors[4].value, sensors[5].value, 0, 0, 0);
+    }
+
+    // unknown - simple return, read 8 bytes
+    bool ReadUnknown16(EbusMessage const &msg, EbusResponse &response)
+    {
+        response = EbusResponse(vr70Unknown16);
+        return true;
+    }
+
+    static constexpr EbusCommand<EbusDeviceVr70> commands[] = {
+        { 0xb503, EBUS_COMMAND_ANY_LEN, EBUS_COMMAND_ANY, &EbusDeviceVr70::Probe },
+        { 0xb523, 9, 0, &EbusDeviceVr70::SetConfig },
+        { 0xb523, 8, 1, &EbusDeviceVr70::SetActorState },
+        { 0xb523, 4, 2, &EbusDeviceVr70::SetMixer },
+        { 0xb523, EBUS_COMMAND_ANY_LEN, 3, &EbusDeviceVr70::ReadSensors },
+        { 0xb516, EBUS_COMMAND_ANY_LEN, 0x11, &EbusDeviceVr70::ReadUnknown16 },
+    };
+    static constexpr auto dispatch = EbusMakeCommandTable(commands);
+
+public:
+    bool ProcessSlaveMessage(EbusMessage const &msg, EbusResponse &response)
+    {
+        bool handled;
+        if (dispatch.Dispatch(this, msg, response, handled))
+            return handled;
         return EbusDeviceBase1::ProcessSlaveMessage(msg, response);
     }
 
@@ -138,21 +158,24 @@ public:
         for(n=0;n<2;n++){
             printf(" M%d: e:%d", n, mixers[n].enabled);
             if (mixers[n].enabled)
-                printf(" a:%d d:%d.%d p:%d", mixers[n].active, (int)(mixers[n].desired), ((int)mixers[n].desired*10)%10, mixers[n].pos);
+                printf(" a:%d d:%.1f p:%d", mixers[n].active, mixers[n].desired.ToFloat(), mixers[n].pos);
         }
         printf("\r\nSensors:");
         for(n=0;n<6;n++)
-            printf(" S%d(%d):%d.%d", n, sensors[n].mode, (int)(sensors[n].value), ((int)sensors[n].value*10)%10);
+            printf(" S%d(%d):%.1f", n, sensors[n].mode, sensors[n].value.ToFloat());
         printf("\r\n");
     }
 
-    void SetSensor(int index, float val)
+    void SetSensor(int index, EbusFixed val)
     {
         sensors[index].value = val;
     }
 
 };
 
+constexpr EbusCommand<EbusDeviceVr70> EbusDeviceVr70::commands[];
+constexpr decltype(EbusDeviceVr70::dispatch) EbusDeviceVr70::dispatch;
+
 const static uint8_t slaveAddressess[] = {0x52};
 EbusDeviceVr70 *vr70[sizeof(slaveAddressess)] = {0};
 
@@ -228,7 +251,7 @@ int sensor_vr70_func(int argc, char **argv)
     auto sensor = vr70_sensor_args.sensor->ival[0];
     if (sensor<0 || sensor>6)
         return 1;
-    vr70[index]->SetSensor(sensor, vr70_sensor_args.value->dval[0]);
+    vr70[index]->SetSensor(sensor, EbusFixed::FromFloat(vr70_sensor_args.value->dval[0]));
     return 0;
 }
 
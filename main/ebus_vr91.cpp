@@ -7,47 +7,51 @@
 
 #include "ebus_dev.h"
 #include "ebus_device.h"
+#include "ebus_schema.h"
 
 #include "esp_log.h"
 #include "argtable3/argtable3.h"
 #include "esp_console.h"
+// b524 06: data, 0-read 1-wr, 09=int 0a=remote, index, register, value
+typedef EbusSchema<EbusByte, EbusByte, EbusByte, EbusByte, EbusWord, EbusEXP> Vr91Reading;
+// b524 08 response: zone, ?, mode, ?, ?, ?, desired, ?
+typedef EbusSchema<EbusByte, EbusByte, EbusByte, EbusByte, EbusByte, EbusByte, EbusData1c,
+    EbusByte> Vr91Query;
 
 class EbusDeviceVr91 : public EbusDeviceBase
 {
-    float temp, humid, desiredTemp;
+    EbusFixed temp, humid, desiredTemp;
     uint8_t index, zone;
+    // b524 08 to the controller
+    const EbusConstFrame query;
     enum class Mode { Off=0, Auto=1, Day=2, Setback=3 };
 
     Mode mode;
 
 
-    void SendReading(uint8_t reg, float val)
+    void SendReading(uint8_t reg, EbusFixed val)
     {
         if ( zone == 0xff ) return;
-        auto msg = new EbusMessage(masterAddress, 0x15, 0xb524);
+        auto msg = EbusMessagePtr::Create(masterAddress, 0x15, 0xb524);
+        if (!msg) return;
         //06010a010f00
-        msg->AddPayload(0x06); // data
-        msg->AddPayload(0x01); // 0-read 1-wr
-        msg->AddPayload(0x0a); // 09=int, 0a=remote
-        msg->AddPayload(index); // index
-
-        msg->AddPayloadWord(reg); // 7=humid f=temp
-
-        msg->AddPayloadEXP(val);
+        // register 7=humid f=temp
+        Vr91Reading::Encode(*msg, 0x06, 0x01, 0x0a, index, reg, val);
         msg->SetCRC();
-        bus->QueueMessage(msg);
+        bus->QueueMessage(std::move(msg), EbusTxClass::Control);
 
     }
 public:
     EbusDeviceVr91(uint8_t masterAddr, uint8_t idx, EbusBus *bus)
     // SW=0415;HW=4803"
-        : EbusDeviceBase(masterAddr, 0xb5, "VR_91", 0x0200+idx, 0x1903, bus)
+        : EbusDeviceBase(masterAddr, 0xb5, "VR_91", 0x0200+idx, 0x1903, bus),
+        query(EbusMakeFrame(masterAddr, 0x15, 0xb524, 0x08))
     {
         index = idx;
         zone = 0xff;
-        temp = 16.5f + idx;
-        humid = 49.5f;
-        desiredTemp = 0.0f;
+        temp = EbusFixed::FromFloat(16.5f) + EbusFixed::FromInt(idx);
+        humid = EbusFixed::FromFloat(49.5f);
+        desiredTemp = EbusFixed::FromInt(0);
         mode = Mode::Off;
     }
 
@@ -65,9 +69,10 @@ public:
                     case 8: // query
                         // resp - 08 000001010c012e30
                         if (response.GetPayloadLength() == 8){
-                            zone = response.GetPayload()[0];
-                            mode = (Mode)response.GetPayload()[2];
-                            desiredTemp = response.ReadPayloadData1c(6);
+                            uint8_t modeGot, unknown[5];
+                            Vr91Query::Decode(response, zone, unknown[0], modeGot, unknown[1], unknown[2],
+                                unknown[3], desiredTemp, unknown[4]);
+                            mode = (Mode)modeGot;
                             return true;
                         }
                 }
@@ -82,11 +87,10 @@ public:
         switch (cnt % 60) {
             case 1:
             {
-                auto msg = new EbusMessage(masterAddress, 0x15, 0xb524);
+                auto msg = EbusMessagePtr::Create(query);
+                if (!msg) break;
                 // resp - 08000001010c012e30
-                msg->AddPayload(0x08); // query
-                msg->SetCRC();
-                bus->QueueMessage(msg);
+                bus->QueueMessage(std::move(msg));
                 break;
             }
             case 10:
@@ -105,8 +109,8 @@ public:
     void print()
     {
         printf("VR91: id:%02x\r\n", masterAddress);
-        printf(" index:%d mode:%d desired:%.1f\r\n", index, (int)mode, desiredTemp);
-        printf(" Temp:%.1f humid:%.1f\r\n", temp, humid);
+        printf(" index:%d mode:%d desired:%.1f\r\n", index, (int)mode, desiredTemp.ToFloat());
+        printf(" Temp:%.1f humid:%.1f\r\n", temp.ToFloat(), humid.ToFloat());
     }
 
     /*
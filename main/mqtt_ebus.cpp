@@ -9,12 +9,19 @@
 
 #include "esp_log.h"
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/timers.h"
+
 #include "mqtt_client.h"
 #include "ebus.h"
 #include "ebus_dev.h"
+#include "ebus_stats.h"
+#include "ebus_monitor.h"
 
 static const char *TAG = "MQTT_EBUS";
 
+#define MQTT_STATS_PERIOD_MS 60000
+
 
 esp_err_t nvs_get_string(nvs_handle handle, const char*key, std::string &str)
 {
@@ -36,6 +43,10 @@ class MqttMonitor : public EbusMonitor
 
 protected:
     esp_mqtt_client_handle_t client = nullptr;
+    EbusBusStats *stats;
+    TimerHandle_t statsTimer = nullptr;
+    // set by the timer, published from the monitor task
+    volatile bool statsDue = false;
     // needed to persist for lifetime of client
     std::string server_name;
     std::string username;
@@ -102,10 +113,37 @@ protected:
         mon->mqtt_event_handler_cb((esp_mqtt_event_handle_t)event_data);
     }
 
+    // The timer task also generates SYNs and runs the device timers, a
+    // publish blocked on the client or its socket must not happen there.
+    static void StatsTimerCallback(TimerHandle_t xTimer)
+    {
+        auto mon = (MqttMonitor*)pvTimerGetTimerID(xTimer);
+        mon->statsDue = true;
+        EbusAsyncMonitor::Wake();
+    }
+
+    // the counters are read while the bus task updates them, a figure
+    // may be one event behind another
+    void PublishStats()
+    {
+        char buffer[128];
+        auto len = stats->FormatCompact(buffer, sizeof(buffer));
+        if (len > 0 && len < (int)sizeof(buffer))
+            esp_mqtt_client_publish(client, "ebus/stats", buffer, len, 0, 0);
+    }
+
 public:
-    MqttMonitor(EbusSender *sender)
+    MqttMonitor(EbusSender *sender, EbusBusStats *stats) : stats(stats)
     {}
 
+    void Poll()
+    {
+        if (statsDue) {
+            statsDue = false;
+            PublishStats();
+        }
+    }
+
     void start(void)
     {
         esp_mqtt_client_config_t mqtt_cfg = {};
@@ -139,6 +177,11 @@ public:
         esp_mqtt_client_register_event(client, MQTT_EVENT_ANY, mqtt_event_handler, this);
         esp_mqtt_client_start(client);
 
+        if (stats) {
+            statsTimer = xTimerCreate("mqtt_stats", MQTT_STATS_PERIOD_MS / portTICK_PERIOD_MS, true, this, StatsTimerCallback);
+            xTimerStart(statsTimer, 0);
+        }
+
     close_handle:
         nvs_close(handle);
     }
@@ -194,9 +237,9 @@ extern "C" {
     void mqtt_app_start(void);
 }
 
-EbusMonitor *initialise_mqtt(EbusSender *sender)
+EbusMonitor *initialise_mqtt(EbusSender *sender, EbusBusStats *stats)
 {
-    auto mon = new MqttMonitor(sender);
+    auto mon = new MqttMonitor(sender, stats);
     mon->start();
     return mon;
 }
\ No newline at end of file